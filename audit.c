@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/fcntl.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include "audit.h"
+
+/**
+ * Audit log of executed commands, one JSON object per line.
+ * Records are kept in memory and written with a single writev once a batch is full, and at exit.
+ */
+
+#define AUDIT_BATCH_RECORDS 64
+#define AUDIT_BATCH_BYTES (64 * 1024)
+
+static int auditFd = -1;
+static char *logPath = NULL;
+static struct iovec pending[AUDIT_BATCH_RECORDS];
+static int pendingCount = 0;
+static size_t pendingBytes = 0;
+
+/**
+ * Start logging to a file, replacing any log already open
+ * @param path file to append records to
+ * @return true if the file could be opened
+ */
+bool auditOpen(const char *path) {
+    auditClose();
+    auditFd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (auditFd < 0) {
+        return false;
+    }
+    logPath = strdup(path);
+    return true;
+}
+
+/**
+ * Flush and close the log, if one is open
+ */
+void auditClose(void) {
+    if (auditFd < 0) {
+        return;
+    }
+    auditFlush();
+    close(auditFd);
+    free(logPath);
+    auditFd = -1;
+    logPath = NULL;
+}
+
+/**
+ * @return path of the log, NULL if there is none
+ */
+const char *auditPath(void) {
+    return logPath;
+}
+
+/**
+ * Write out every pending record
+ */
+void auditFlush(void) {
+    struct iovec *iov = pending;
+    int count = pendingCount;
+    while (count > 0 && auditFd >= 0) {
+        const ssize_t n = writev(auditFd, iov, count);
+        if (n < 0) {
+            perror("audit-log");
+            break;
+        }
+        // Skip whatever was written, including a partially written record
+        size_t written = (size_t) n;
+        while (count > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    for (int i = 0; i < pendingCount; ++i) {
+        free(pending[i].iov_base);
+    }
+    pendingCount = 0;
+    pendingBytes = 0;
+}
+
+/**
+ * Begin a record for a command line, before it gets tokenized
+ * @param line the command line
+ * @return the record, NULL if the audit log is off
+ */
+auditRecord *auditStart(const char *line) {
+    if (auditFd < 0) {
+        return NULL;
+    }
+    auditRecord *const record = malloc(sizeof(auditRecord));
+    record->line = strdup(line);
+    record->cwd = getcwd(NULL, 0);
+    clock_gettime(CLOCK_REALTIME, &record->start);
+    return record;
+}
+
+/**
+ * Drop a record without logging it
+ * @param record record returned by auditStart, may be NULL
+ */
+void auditDiscard(auditRecord *record) {
+    if (record != NULL) {
+        free(record->line);
+        free(record->cwd);
+        free(record);
+    }
+}
+
+/**
+ * Append a JSON string, escaped
+ * @param out buffer to append to, must have room for 6 bytes per character
+ * @param value string to append
+ * @return pointer to the end of the appended string
+ */
+static char *appendJsonString(char *out, const char *value) {
+    *out++ = '"';
+    for (; value != NULL && *value != '\0'; ++value) {
+        const unsigned char c = (unsigned char) *value;
+        if (c == '"' || c == '\\') {
+            *out++ = '\\';
+            *out++ = (char) c;
+        } else if (c < 0x20) {
+            out += sprintf(out, "\\u%04x", c);
+        } else {
+            *out++ = (char) c;
+        }
+    }
+    *out++ = '"';
+    return out;
+}
+
+/**
+ * Complete a record and queue it to be written, the record is freed
+ * @param record record returned by auditStart, may be NULL
+ * @param status wait status of the command
+ * @param usage resource usage of the command, may be NULL
+ */
+void auditFinish(auditRecord *record, int status, const struct rusage *usage) {
+    if (record == NULL) {
+        return;
+    }
+    struct timespec end;
+    clock_gettime(CLOCK_REALTIME, &end);
+
+    const size_t size = 6 * (strlen(record->line) + (record->cwd != NULL ? strlen(record->cwd) : 0)) + 512;
+    char *const text = malloc(size);
+    char *out = text;
+    out += sprintf(out, "{\"cmd\":");
+    out = appendJsonString(out, record->line);
+    out += sprintf(out, ",\"cwd\":");
+    out = appendJsonString(out, record->cwd);
+    out += sprintf(out, ",\"start\":%lld.%06ld,\"end\":%lld.%06ld,\"status\":%d",
+                   (long long) record->start.tv_sec, record->start.tv_nsec / 1000,
+                   (long long) end.tv_sec, end.tv_nsec / 1000,
+                   WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status));
+    if (usage != NULL) {
+        out += sprintf(out, ",\"utime\":%ld.%06ld,\"stime\":%ld.%06ld,\"maxrss_kb\":%ld",
+                       (long) usage->ru_utime.tv_sec, (long) usage->ru_utime.tv_usec,
+                       (long) usage->ru_stime.tv_sec, (long) usage->ru_stime.tv_usec, usage->ru_maxrss);
+    }
+    out += sprintf(out, "}\n");
+    auditDiscard(record);
+
+    if (auditFd < 0) {
+        free(text);
+        return;
+    }
+    pending[pendingCount++] = (struct iovec) {text, (size_t) (out - text)};
+    pendingBytes += (size_t) (out - text);
+    if (pendingCount == AUDIT_BATCH_RECORDS || pendingBytes >= AUDIT_BATCH_BYTES) {
+        auditFlush();
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef ASSIGNMENT1_AUDIT_H
+#define ASSIGNMENT1_AUDIT_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/resource.h>
+
+typedef struct auditRecord {
+    char *line;
+    char *cwd;
+    struct timespec start;
+} auditRecord;
+
+bool auditOpen(const char *path);
+
+void auditClose(void);
+
+const char *auditPath(void);
+
+auditRecord *auditStart(const char *line);
+
+void auditFinish(auditRecord *record, int status, const struct rusage *usage);
+
+void auditDiscard(auditRecord *record);
+
+void auditFlush(void);
+
+#endif
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+/**
+ * Drives the shell non-interactively with scripted workloads and reports throughput,
+ * per-command latency and syscalls per command.
+ * Usage: bench [-n count] [-s shell] [workload...]
+ */
+
+#ifndef ASSIGNMENT1_PATH
+#define ASSIGNMENT1_PATH "./assignment1"
+#endif
+
+#define READ_SIZE 4096
+#define LONG_ARG_COUNT 29
+#define LONG_ARG_LENGTH 200
+#define STORM_BATCH 50
+
+typedef struct shell {
+    pid_t pid;
+    int in;
+    int out;
+    char *prompt;
+    size_t promptLength;
+} shell;
+
+typedef struct workload {
+    const char *name;
+    int (*line)(char *buffer, size_t size, int i);
+} workload;
+
+/**
+ * Current monotonic time
+ * @return time in nanoseconds
+ */
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Read the amount of read and write syscalls a process has made so far
+ * @param pid process to inspect
+ * @return syscr + syscw from /proc/<pid>/io, 0 if unavailable
+ */
+static uint64_t syscallCount(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/io", (int) pid);
+    FILE *const file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+
+    uint64_t total = 0;
+    char line[128];
+    unsigned long long value;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "syscr: %llu", &value) == 1 || sscanf(line, "syscw: %llu", &value) == 1) {
+            total += value;
+        }
+    }
+    fclose(file);
+    return total;
+}
+
+/**
+ * Read shell output until the prompt is printed again
+ * @param sh shell to read from
+ * @return true if the prompt was seen, false if the shell went away
+ */
+static bool waitForPrompt(const shell *const sh) {
+    char buffer[READ_SIZE];
+    // Keep the end of the previous read around in case the prompt is split across reads
+    char tail[READ_SIZE * 2];
+    size_t tailLength = 0;
+    while (1) {
+        const ssize_t n = read(sh->out, buffer, sizeof(buffer));
+        if (n <= 0) {
+            return false;
+        }
+        if (tailLength + (size_t) n > sizeof(tail)) {
+            const size_t keep = sh->promptLength < tailLength ? sh->promptLength : tailLength;
+            memmove(tail, tail + tailLength - keep, keep);
+            tailLength = keep;
+        }
+        memcpy(tail + tailLength, buffer, (size_t) n);
+        tailLength += (size_t) n;
+        if (tailLength >= sh->promptLength &&
+            memcmp(tail + tailLength - sh->promptLength, sh->prompt, sh->promptLength) == 0) {
+            return true;
+        }
+    }
+}
+
+/**
+ * Start the shell in its own session, so its exit does not signal the benchmark
+ * @param path path to the shell binary
+ * @param sh shell to be populated
+ * @return true if the shell started and printed its first prompt
+ */
+static bool startShell(const char *const path, shell *const sh) {
+    int toShell[2];
+    int fromShell[2];
+    if (pipe(toShell) || pipe(fromShell)) {
+        perror("pipe");
+        return false;
+    }
+
+    sh->pid = fork();
+    if (sh->pid < 0) {
+        perror("fork");
+        return false;
+    }
+    if (sh->pid == 0) {
+        setsid();
+        dup2(toShell[0], STDIN_FILENO);
+        dup2(fromShell[1], STDOUT_FILENO);
+        close(toShell[0]);
+        close(toShell[1]);
+        close(fromShell[0]);
+        close(fromShell[1]);
+        execl(path, path, (char *) NULL);
+        perror(path);
+        exit(127);
+    }
+
+    close(toShell[0]);
+    close(fromShell[1]);
+    sh->in = toShell[1];
+    sh->out = fromShell[0];
+    return waitForPrompt(sh);
+}
+
+/**
+ * Close the shell's stdin and reap it
+ * @param sh shell to stop
+ */
+static void stopShell(const shell *const sh) {
+    close(sh->in);
+    close(sh->out);
+    int status = 0;
+    waitpid(sh->pid, &status, 0);
+}
+
+/**
+ * Compare two latencies, for qsort
+ */
+static int compareLatency(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Workload lines, each writes the ith command line of the workload into buffer
+ * @param buffer buffer to be populated
+ * @param size size of the buffer
+ * @param i index of the command in the workload
+ * @return length of the line
+ */
+static int trivialLine(char *buffer, size_t size, int i) {
+    (void) i;
+    return snprintf(buffer, size, "true\n");
+}
+
+static int builtinLine(char *buffer, size_t size, int i) {
+    return snprintf(buffer, size, i % 2 ? "echo a b c\n" : "pwd\n");
+}
+
+static int pipelineLine(char *buffer, size_t size, int i) {
+    (void) i;
+    return snprintf(buffer, size, "printf x | cat\n");
+}
+
+/**
+ * Background job storm, launches a batch of jobs then reaps them with fg
+ */
+static int stormLine(char *buffer, size_t size, int i) {
+    return snprintf(buffer, size, (i / STORM_BATCH) % 2 ? "fg\n" : "true &\n");
+}
+
+static int longArgsLine(char *buffer, size_t size, int i) {
+    (void) i;
+    size_t length = (size_t) snprintf(buffer, size, "true");
+    for (int arg = 0; arg < LONG_ARG_COUNT && length + LONG_ARG_LENGTH + 2 < size; ++arg) {
+        buffer[length++] = ' ';
+        memset(buffer + length, 'a' + arg % 26, LONG_ARG_LENGTH);
+        length += LONG_ARG_LENGTH;
+    }
+    buffer[length++] = '\n';
+    buffer[length] = '\0';
+    return (int) length;
+}
+
+static const workload workloads[] = {
+        {"trivial",  trivialLine},
+        {"builtin",  builtinLine},
+        {"pipeline", pipelineLine},
+        {"storm",    stormLine},
+        {"longargs", longArgsLine},
+};
+
+/**
+ * Run one workload in a fresh shell and print its results
+ * @param path path to the shell binary
+ * @param w workload to run
+ * @param count amount of commands to send
+ * @param prompt prompt printed by the shell when it is ready for the next command
+ * @return true if the workload completed
+ */
+static bool runWorkload(const char *const path, const workload *const w, int count, const char *const prompt) {
+    shell sh = {.prompt = (char *) prompt, .promptLength = strlen(prompt)};
+    if (!startShell(path, &sh)) {
+        fprintf(stderr, "%s: shell did not start\n", w->name);
+        return false;
+    }
+
+    uint64_t *const latencies = malloc(sizeof(uint64_t) * (size_t) count);
+    char line[LONG_ARG_COUNT * (LONG_ARG_LENGTH + 1) + 64];
+    const uint64_t syscallsBefore = syscallCount(sh.pid);
+    const uint64_t start = nowNs();
+    int done = 0;
+    for (; done < count; ++done) {
+        const int length = w->line(line, sizeof(line), done);
+        const uint64_t sent = nowNs();
+        if (write(sh.in, line, (size_t) length) != length || !waitForPrompt(&sh)) {
+            fprintf(stderr, "%s: shell stopped responding after %d commands\n", w->name, done);
+            break;
+        }
+        latencies[done] = nowNs() - sent;
+    }
+    const uint64_t elapsed = nowNs() - start;
+    const uint64_t syscalls = syscallCount(sh.pid) - syscallsBefore;
+    stopShell(&sh);
+
+    if (done > 0) {
+        qsort(latencies, (size_t) done, sizeof(uint64_t), compareLatency);
+        printf("%-10s %8d %12.0f %10.1f %10.1f %12.1f\n", w->name, done,
+               done / (elapsed / 1e9),
+               latencies[done / 2] / 1e3,
+               latencies[(size_t) done * 99 / 100] / 1e3,
+               (double) syscalls / done);
+    }
+    free(latencies);
+    return done == count;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = ASSIGNMENT1_PATH;
+    int count = 10000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        if (opt == 'n') {
+            count = (int) strtol(optarg, NULL, 10);
+        } else if (opt == 's') {
+            path = optarg;
+        } else {
+            fprintf(stderr, "usage: %s [-n count] [-s shell] [workload...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (count < 1) {
+        fprintf(stderr, "bench: count must be positive\n");
+        return 2;
+    }
+
+    // Run from a fixed directory so the prompt is known in advance
+    char dir[] = "/tmp/assignment1-bench-XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir)) {
+        perror("bench");
+        return 1;
+    }
+    char prompt[sizeof(dir) + 4];
+    snprintf(prompt, sizeof(prompt), "%s > ", dir);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%-10s %8s %12s %10s %10s %12s\n", "workload", "cmds", "cmds/sec", "p50 us", "p99 us", "rw sys/cmd");
+    bool ok = true;
+    const size_t workloadCount = sizeof(workloads) / sizeof(*workloads);
+    for (size_t i = 0; i < workloadCount; ++i) {
+        bool selected = optind == argc;
+        for (int arg = optind; arg < argc; ++arg) {
+            selected |= strcmp(argv[arg], workloads[i].name) == 0;
+        }
+        if (selected) {
+            ok &= runWorkload(path, &workloads[i], count, prompt);
+        }
+    }
+
+    rmdir(dir);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include "tokenizer.h"
+
+/**
+ * Microbenchmark for getcmd, tokenizes generated command lines and reports ns/line and allocations/line.
+ * Usage: bench_getcmd [-n lines] [-s seed]
+ */
+
+#define LINE_COUNT 4096
+#define LINE_SIZE 2048
+
+// glibc's allocator entry points, so every allocation made by the process can be counted
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static uint64_t allocations = 0;
+
+void *malloc(size_t size) {
+    ++allocations;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    ++allocations;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    ++allocations;
+    return __libc_realloc(ptr, size);
+}
+
+static const char *const commands[] = {"ls", "grep", "cat", "echo", "find", "sort", "wc", "sleep", "make", "git"};
+static const char *const words[] = {
+        "-l", "-la", "-v", "-n", "foo", "bar.txt", "/usr/local/bin", "src/main.c", "--color=auto", "10",
+        "a_rather_long_argument_that_keeps_going_and_going", "x", "build/output/assignment1", "-rf", "HEAD~3",
+};
+static const char *const spaces[] = {" ", " ", " ", "  ", "\t", " \t "};
+
+/**
+ * xorshift random number generator, so runs are reproducible
+ * @param state generator state
+ * @return next random number
+ */
+static uint32_t nextRandom(uint32_t *const state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+#define PICK(array, state) (array[nextRandom(state) % (sizeof(array) / sizeof(*(array)))])
+
+/**
+ * Append a command and its arguments to a line
+ * @param line line to append to
+ * @param length current length of the line
+ * @param state random generator state
+ * @param maxWords maximum amount of arguments
+ * @return new length of the line
+ */
+static size_t appendCommand(char *const line, size_t length, uint32_t *const state, uint32_t maxWords) {
+    length += (size_t) sprintf(line + length, "%s", PICK(commands, state));
+    const uint32_t count = nextRandom(state) % (maxWords + 1);
+    for (uint32_t i = 0; i < count; ++i) {
+        length += (size_t) sprintf(line + length, "%s%s", PICK(spaces, state), PICK(words, state));
+    }
+    return length;
+}
+
+/**
+ * Generate a realistic command line with varied length, operators and whitespace
+ * @param line buffer of at least LINE_SIZE bytes to be populated
+ * @param state random generator state
+ * @return length of the line
+ */
+static size_t generateLine(char *const line, uint32_t *const state) {
+    const uint32_t shape = nextRandom(state) % 100;
+    // Mostly short commands, with the occasional long one
+    const uint32_t maxWords = shape < 90 ? 4 : 12;
+    size_t length = appendCommand(line, 0, state, maxWords);
+    if (shape % 5 == 0) {
+        length += (size_t) sprintf(line + length, "%s|%s", PICK(spaces, state), PICK(spaces, state));
+        length = appendCommand(line, length, state, maxWords);
+    }
+    if (shape % 7 == 0) {
+        length += (size_t) sprintf(line + length, " > out.txt");
+    }
+    if (shape % 11 == 0) {
+        length += (size_t) sprintf(line + length, "%s&", PICK(spaces, state));
+    }
+    return length;
+}
+
+/**
+ * Current monotonic time
+ * @return time in nanoseconds
+ */
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = 5000000;
+    uint32_t seed = 12345;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        if (opt == 'n') {
+            iterations = strtol(optarg, NULL, 10);
+        } else if (opt == 's') {
+            seed = (uint32_t) strtoul(optarg, NULL, 10);
+        } else {
+            fprintf(stderr, "usage: %s [-n lines] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (iterations < 1 || seed == 0) {
+        fprintf(stderr, "bench_getcmd: lines and seed must be positive\n");
+        return 2;
+    }
+
+    static char lines[LINE_COUNT][LINE_SIZE];
+    static size_t lengths[LINE_COUNT];
+    size_t totalBytes = 0;
+    for (int i = 0; i < LINE_COUNT; ++i) {
+        lengths[i] = generateLine(lines[i], &seed);
+        totalBytes += lengths[i];
+    }
+
+    char buffer[LINE_SIZE];
+    char *args[ARGS_SIZE + 1];
+    char *outputRedirection = NULL;
+    bool background = false;
+    int cmdPipeIndex = -1;
+    uint64_t tokens = 0;
+
+    // getcmd tokenizes in place, so each line is copied first, time the copies on their own to subtract them
+    const uint64_t copyStart = nowNs();
+    for (long i = 0; i < iterations; ++i) {
+        const size_t index = (size_t) i % LINE_COUNT;
+        memcpy(buffer, lines[index], lengths[index] + 1);
+        __asm__ volatile("" : : "r"(buffer) : "memory");
+    }
+    const uint64_t copyTime = nowNs() - copyStart;
+
+    const uint64_t allocationsBefore = allocations;
+    const uint64_t start = nowNs();
+    for (long i = 0; i < iterations; ++i) {
+        const size_t index = (size_t) i % LINE_COUNT;
+        memcpy(buffer, lines[index], lengths[index] + 1);
+        tokens += (uint64_t) getcmd(buffer, (ssize_t) lengths[index] - 1, args, &background, &outputRedirection,
+                                    &cmdPipeIndex);
+    }
+    const uint64_t elapsed = nowNs() - start;
+    const uint64_t allocated = allocations - allocationsBefore;
+
+    const double ns = elapsed > copyTime ? (double) (elapsed - copyTime) / (double) iterations : 0;
+    printf("lines          %ld\n", iterations);
+    printf("avg bytes/line %.1f\n", (double) totalBytes / LINE_COUNT);
+    printf("avg tokens     %.2f\n", (double) tokens / (double) iterations);
+    printf("ns/line        %.1f\n", ns);
+    printf("ns/byte        %.2f\n", ns * LINE_COUNT / (double) totalBytes);
+    printf("allocs/line    %.3f\n", (double) allocated / (double) iterations);
+    return 0;
+}
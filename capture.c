@@ -0,0 +1,417 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/fcntl.h>
+#include <sys/uio.h>
+#include "capture.h"
+#include "eventloop.h"
+#include "spawn.h"
+#include "stream.h"
+
+/**
+ * Output capture for background jobs. With capture-output on, a job's stdout and stderr share a pipe that the
+ * event loop drains while the shell waits, so nothing is printed over the prompt. The latest output is kept in
+ * memory, output beyond CAPTURE_MEMORY moves to an unlinked temporary file, so small outputs never touch the disk.
+ * jobs --output replays it, fg replays it and then follows the job's output live.
+ * With tag-output on, the shell prints the lines of every job itself instead, each prefixed with the job's name
+ * and pid, so lines of jobs running at the same time are never torn. Complete lines of one read go out with a single
+ * writev. tag-output=ordered holds a job's lines until every job started before it has finished, like
+ * parallel --keep-order.
+ */
+
+#define CAPTURE_MEMORY 65536
+#define TAG_BATCH 192
+
+bool captureOutput = false;
+tagMode tagOutput = TAG_OFF;
+
+// Tagged outputs in the order their jobs started, for tag-output=ordered, the first one is printed live
+static jobOutput *orderedHead = NULL;
+static jobOutput *orderedTail = NULL;
+
+static void outputDestroy(jobOutput *output);
+
+/**
+ * Write all of a buffer to stdout
+ * @param buffer bytes to write
+ * @param size amount of bytes
+ */
+static void writeOut(const char *buffer, size_t size) {
+    while (size > 0) {
+        const ssize_t n = write(STDOUT_FILENO, buffer, size);
+        if (n < 0 && errno != EINTR) {
+            return;
+        }
+        buffer += n > 0 ? n : 0;
+        size -= n > 0 ? (size_t) n : 0;
+    }
+}
+
+/**
+ * Write all of a buffer to the spill file, creating it if needed
+ * @param output output of the job
+ * @param buffer bytes to write
+ * @param size amount of bytes
+ * @return false if the file could not be created or written, the bytes are dropped
+ */
+static bool spill(jobOutput *output, const char *buffer, size_t size) {
+    if (output->spill < 0 && (output->spill = streamTemporary("output")) < 0) {
+        return false;
+    }
+    while (size > 0) {
+        const ssize_t n = pwrite(output->spill, buffer, size, output->spilled);
+        if (n < 0 && errno != EINTR) {
+            return false;
+        }
+        output->spilled += n > 0 ? n : 0;
+        buffer += n > 0 ? n : 0;
+        size -= n > 0 ? (size_t) n : 0;
+    }
+    return true;
+}
+
+/**
+ * Keep output of a job
+ * @param output output of the job
+ * @param buffer bytes the job wrote
+ * @param size amount of bytes
+ */
+static void outputAppend(jobOutput *output, const char *buffer, size_t size) {
+    if (output->length + size > CAPTURE_MEMORY) {
+        if (!spill(output, output->buffer, output->length)) {
+            perror("capture-output");
+        }
+        output->length = 0;
+        if (size > CAPTURE_MEMORY) {
+            spill(output, buffer, size);
+            return;
+        }
+    }
+    memcpy(output->buffer + output->length, buffer, size);
+    output->length += size;
+}
+
+/**
+ * Print the output kept so far
+ * @param output output of the job
+ */
+static void outputPrint(const jobOutput *output) {
+    fflush(stdout);
+    char buffer[CAPTURE_MEMORY];
+    for (off_t offset = 0; offset < output->spilled;) {
+        const ssize_t n = pread(output->spill, buffer, sizeof(buffer), offset);
+        if (n <= 0) {
+            break;
+        }
+        writeOut(buffer, (size_t) n);
+        offset += n;
+    }
+    writeOut(output->buffer, output->length);
+}
+
+/**
+ * Print tagged lines, or keep them while the output is held
+ * @param output output of the job
+ * @param iov the lines, tags included
+ * @param count amount of entries in iov
+ */
+static void tagFlush(jobOutput *output, struct iovec *iov, int count) {
+    if (output->held) {
+        for (int i = 0; i < count; ++i) {
+            outputAppend(output, iov[i].iov_base, iov[i].iov_len);
+        }
+        return;
+    }
+    while (count > 0) {
+        ssize_t n = writev(STDOUT_FILENO, iov, count);
+        if (n < 0 && errno != EINTR) {
+            return;
+        }
+        // Skip what was written, a short write leaves the rest of an entry
+        for (; count > 0 && n >= (ssize_t) iov->iov_len; ++iov, --count) {
+            n -= (ssize_t) iov->iov_len;
+        }
+        if (count > 0 && n > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= (size_t) n;
+        }
+    }
+}
+
+/**
+ * Print the complete lines of output read from a tagged job, keeping the start of an unfinished line
+ * @param output output of the job
+ * @param data bytes read from the job
+ * @param size amount of bytes
+ */
+static void tagLines(jobOutput *output, const char *data, size_t size) {
+    struct iovec iov[TAG_BATCH];
+    int count = 0;
+    const char *const end = data + size;
+    const char *newline;
+    while ((newline = memchr(data, '\n', (size_t) (end - data))) != NULL) {
+        if (count + 3 > TAG_BATCH) {
+            tagFlush(output, iov, count);
+            count = 0;
+        }
+        iov[count++] = (struct iovec) {output->tag, output->tagLength};
+        if (output->partialLength > 0) {
+            // Stays valid until the next unfinished line is stored, after the last flush
+            iov[count++] = (struct iovec) {output->partial, output->partialLength};
+            output->partialLength = 0;
+        }
+        iov[count++] = (struct iovec) {(char *) data, (size_t) (newline + 1 - data)};
+        data = newline + 1;
+    }
+    tagFlush(output, iov, count);
+
+    while (data < end) {
+        if (output->partial == NULL) {
+            output->partial = malloc(CAPTURE_MEMORY);
+        }
+        const size_t space = CAPTURE_MEMORY - output->partialLength;
+        const size_t length = (size_t) (end - data) < space ? (size_t) (end - data) : space;
+        memcpy(output->partial + output->partialLength, data, length);
+        output->partialLength += length;
+        data += length;
+        // A line too long to keep goes out in pieces
+        if (output->partialLength == CAPTURE_MEMORY) {
+            struct iovec piece[3] = {{output->tag, output->tagLength}, {output->partial, CAPTURE_MEMORY},
+                                     {"\n", 1}};
+            tagFlush(output, piece, 3);
+            output->partialLength = 0;
+        }
+    }
+}
+
+/**
+ * Print the output kept while a tagged job was held, its lines go out live from now on
+ * @param output output of the job
+ */
+static void tagRelease(jobOutput *output) {
+    output->held = false;
+    outputPrint(output);
+    output->length = 0;
+    output->spilled = 0;
+}
+
+/**
+ * Drop finished jobs from the front of the order, releasing the next one
+ */
+static void orderAdvance(void) {
+    while (orderedHead != NULL && orderedHead->fd < 0) {
+        jobOutput *const done = orderedHead;
+        orderedHead = done->nextOrdered;
+        done->nextOrdered = NULL;
+        done->queued = false;
+        // The job was removed while its lines were held, they have just been printed
+        if (done->orphaned) {
+            outputDestroy(done);
+        }
+        if (orderedHead != NULL) {
+            tagRelease(orderedHead);
+        }
+    }
+    if (orderedHead == NULL) {
+        orderedTail = NULL;
+    }
+}
+
+/**
+ * Finish the output of a tagged job at the end of its pipe
+ * @param output output of the job
+ */
+static void tagFinish(jobOutput *output) {
+    if (output->partialLength > 0) {
+        struct iovec iov[3] = {{output->tag, output->tagLength}, {output->partial, output->partialLength},
+                               {"\n", 1}};
+        tagFlush(output, iov, 3);
+        output->partialLength = 0;
+    }
+    if (output->queued) {
+        orderAdvance();
+    }
+}
+
+/**
+ * Read what is available on a job's pipe, closing it at its end
+ * @param output output of the job
+ */
+static void outputDrain(jobOutput *output) {
+    char buffer[CAPTURE_MEMORY];
+    while (output->fd >= 0) {
+        const ssize_t n = read(output->fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            return;
+        }
+        if (n <= 0) {
+            eventLoopRemove(output->fd);
+            close(output->fd);
+            output->fd = -1;
+            if (output->tag != NULL) {
+                tagFinish(output);
+            }
+            return;
+        }
+        if (output->tag != NULL) {
+            tagLines(output, buffer, (size_t) n);
+        } else if (output->follow) {
+            writeOut(buffer, (size_t) n);
+        } else {
+            outputAppend(output, buffer, (size_t) n);
+        }
+    }
+}
+
+/**
+ * Event loop handler of a job's pipe
+ * @param fd the pipe
+ * @param context output of the job
+ */
+static void outputReadable(int fd, void *context) {
+    (void) fd;
+    outputDrain(context);
+}
+
+/**
+ * Start tagging the lines of a job
+ * @param output output of the job
+ * @param name name of the job
+ * @param pid pid of the job
+ */
+static void tagStart(jobOutput *output, const char *name, pid_t pid) {
+    const int length = snprintf(NULL, 0, "%s[%d]: ", name, (int) pid);
+    output->tag = malloc((size_t) length + 1);
+    snprintf(output->tag, (size_t) length + 1, "%s[%d]: ", name, (int) pid);
+    output->tagLength = (size_t) length;
+    if (tagOutput == TAG_ORDERED) {
+        output->held = orderedHead != NULL;
+        output->queued = true;
+        if (orderedTail != NULL) {
+            orderedTail->nextOrdered = output;
+        } else {
+            orderedHead = output;
+        }
+        orderedTail = output;
+    }
+}
+
+/**
+ * Start a background job, capturing or tagging its output if capture-output or tag-output is on
+ * @param args command/s (tokenized)
+ * @param outputRedirection where the output should be redirected, if NULL no redirection will take place
+ * @param cmdPipeIndex the next index after where the pipe was found, if -1 then no command piping will take place
+ * @param niceness nice increment for the job, relative to the shell
+ * @param pidfd pointer to be populated with a pidfd of the job, -1 if there is none
+ * @param output pointer to be populated with the captured output, NULL if it is not captured
+ * @return pid of the job, -1 if it could not be started
+ */
+pid_t spawnCaptured(char *args[], const char *const outputRedirection, int cmdPipeIndex, int niceness, int *pidfd,
+                    jobOutput **output) {
+    *output = NULL;
+    int fds[2];
+    if ((!captureOutput && tagOutput == TAG_OFF) || pipe2(fds, O_CLOEXEC)) {
+        return spawnCommand(args, outputRedirection, cmdPipeIndex, niceness, pidfd);
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    jobOutput *const captured = malloc(sizeof(jobOutput));
+    *captured = (jobOutput) {.fd = fds[0], .buffer = malloc(CAPTURE_MEMORY), .spill = -1};
+    // Without a free watch the output goes to the terminal as usual
+    if (!eventLoopAdd(fds[0], outputReadable, captured)) {
+        close(fds[1]);
+        outputFree(captured);
+        return spawnCommand(args, outputRedirection, cmdPipeIndex, niceness, pidfd);
+    }
+
+    const pid_t pid = spawnCommandWithOutput(args, outputRedirection, cmdPipeIndex, niceness, pidfd, fds[1]);
+    close(fds[1]);
+    if (pid < 0) {
+        const int savedErrno = errno;
+        outputFree(captured);
+        errno = savedErrno;
+        return -1;
+    }
+    if (tagOutput != TAG_OFF) {
+        tagStart(captured, *args, pid);
+    }
+    *output = captured;
+    return pid;
+}
+
+/**
+ * Print the output a job has written so far
+ * @param output output of the job
+ */
+void outputReplay(jobOutput *output) {
+    outputDrain(output);
+    outputPrint(output);
+}
+
+/**
+ * Start or stop following a job's output, while it runs in the foreground
+ * @param output output of the job
+ * @param follow true to print new output as it arrives, false to keep it again
+ */
+void outputFollow(jobOutput *output, bool follow) {
+    // Whatever is waiting on the pipe goes out while following, or is kept from now on
+    if (follow) {
+        fflush(stdout);
+        output->follow = true;
+        outputDrain(output);
+    } else {
+        outputDrain(output);
+        output->follow = false;
+    }
+}
+
+/**
+ * Free an output
+ * @param output output of the job
+ */
+static void outputDestroy(jobOutput *output) {
+    if (output->fd >= 0) {
+        eventLoopRemove(output->fd);
+        close(output->fd);
+        output->fd = -1;
+    }
+    if (output->spill >= 0) {
+        close(output->spill);
+    }
+    free(output->tag);
+    free(output->partial);
+    free(output->buffer);
+    free(output);
+}
+
+/**
+ * Stop capturing a job's output and free it. The rest of a tagged job's output is still printed: its pipe is
+ * drained, an unfinished last line ends it, and lines held for tag-output=ordered stay queued until the jobs
+ * started before it have finished.
+ * @param output output of the job, may be NULL
+ */
+void outputFree(jobOutput *output) {
+    if (output == NULL) {
+        return;
+    }
+    if (output->tag != NULL) {
+        outputDrain(output);
+        // Still open once the job has exited means a process it left behind holds the pipe, the job is over anyway
+        if (output->fd >= 0) {
+            eventLoopRemove(output->fd);
+            close(output->fd);
+            output->fd = -1;
+            tagFinish(output);
+        }
+        if (output->queued) {
+            output->orphaned = true;
+            return;
+        }
+    }
+    outputDestroy(output);
+}
@@ -0,0 +1,53 @@
+#ifndef ASSIGNMENT1_CAPTURE_H
+#define ASSIGNMENT1_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct jobOutput {
+    // Read end of the job's output pipe, -1 once every writer has closed it
+    int fd;
+    // Latest output, older output is in the spill file
+    char *buffer;
+    size_t length;
+    // Unlinked temporary file holding output beyond the buffer, -1 if there is none
+    int spill;
+    off_t spilled;
+    // True while the job is in the foreground, its output then goes straight to stdout
+    bool follow;
+    // Prefix of every line of a tagged job, NULL if the output is kept rather than tagged
+    char *tag;
+    size_t tagLength;
+    // Start of a line that has not ended yet
+    char *partial;
+    size_t partialLength;
+    // True while tagged lines are kept until the jobs started before have finished, for tag-output=ordered
+    bool held;
+    bool queued;
+    // True once the job is gone while its held lines wait for their turn, they are freed once printed
+    bool orphaned;
+    struct jobOutput *nextOrdered;
+} jobOutput;
+
+typedef enum tagMode {
+    TAG_OFF,
+    TAG_ON,
+    TAG_ORDERED,
+} tagMode;
+
+// Whether background jobs get their output captured, the capture-output option
+extern bool captureOutput;
+// Whether the lines of background jobs are printed tagged, the tag-output option
+extern tagMode tagOutput;
+
+pid_t spawnCaptured(char *args[], const char *outputRedirection, int cmdPipeIndex, int niceness, int *pidfd,
+                    jobOutput **output);
+
+void outputReplay(jobOutput *output);
+
+void outputFollow(jobOutput *output, bool follow);
+
+void outputFree(jobOutput *output);
+
+#endif
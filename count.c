@@ -0,0 +1,260 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "count.h"
+
+/**
+ * The count stream builtin, counting identical lines in one pass like `sort | uniq -c` without the sort.
+ * Lines are looked up in an open addressing hash table with linear probing, the table only holds hashes and
+ * entry indices so probing stays in cache, and the text of each distinct line is copied once into an arena.
+ */
+
+#define ARENA_BLOCK_SIZE (1 << 20)
+#define COUNT_INITIAL_SLOTS 1024
+
+typedef struct arenaBlock {
+    struct arenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} arenaBlock;
+
+typedef struct countEntry {
+    const char *text;
+    size_t length;
+    size_t count;
+} countEntry;
+
+typedef struct countSlot {
+    uint64_t hash;
+    // Index of the entry plus one, 0 for a free slot
+    size_t entry;
+} countSlot;
+
+typedef struct counter {
+    countSlot *slots;
+    // Always a power of two
+    size_t slotCount;
+    countEntry *entries;
+    size_t entryCount;
+    size_t entryCapacity;
+    arenaBlock *arena;
+    // Line read so far
+    char *line;
+    size_t lineLength;
+    size_t lineCapacity;
+} counter;
+
+/**
+ * Copy bytes into the arena, where they stay until the arena is freed
+ * @param c the counter
+ * @param text bytes to copy
+ * @param length amount of bytes
+ * @return the copy
+ */
+static const char *arenaCopy(counter *c, const char *text, size_t length) {
+    if (c->arena == NULL || c->arena->size - c->arena->used < length) {
+        const size_t size = length > ARENA_BLOCK_SIZE ? length : ARENA_BLOCK_SIZE;
+        arenaBlock *const block = malloc(sizeof(arenaBlock) + size);
+        *block = (arenaBlock) {c->arena, 0, size};
+        c->arena = block;
+    }
+    char *const copy = c->arena->data + c->arena->used;
+    memcpy(copy, text, length);
+    c->arena->used += length;
+    return copy;
+}
+
+/**
+ * @param text line
+ * @param length length of the line
+ * @return FNV-1a hash of the line
+ */
+static uint64_t hashLine(const char *text, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ (unsigned char) text[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Double the hash table, re-inserting every entry
+ * @param c the counter
+ */
+static void growTable(counter *c) {
+    const size_t slotCount = c->slotCount > 0 ? c->slotCount * 2 : COUNT_INITIAL_SLOTS;
+    countSlot *const slots = calloc(slotCount, sizeof(countSlot));
+    for (size_t i = 0; i < c->slotCount; ++i) {
+        if (c->slots[i].entry != 0) {
+            size_t j = c->slots[i].hash & (slotCount - 1);
+            while (slots[j].entry != 0) {
+                j = (j + 1) & (slotCount - 1);
+            }
+            slots[j] = c->slots[i];
+        }
+    }
+    free(c->slots);
+    c->slots = slots;
+    c->slotCount = slotCount;
+}
+
+/**
+ * Count one line
+ * @param c the counter
+ * @param text line, without its newline
+ * @param length length of the line
+ */
+static void countLine(counter *c, const char *text, size_t length) {
+    // Keep the table at most half full
+    if (2 * (c->entryCount + 1) > c->slotCount) {
+        growTable(c);
+    }
+    const uint64_t hash = hashLine(text, length);
+    size_t i = hash & (c->slotCount - 1);
+    for (; c->slots[i].entry != 0; i = (i + 1) & (c->slotCount - 1)) {
+        countEntry *const entry = &c->entries[c->slots[i].entry - 1];
+        if (c->slots[i].hash == hash && entry->length == length && memcmp(entry->text, text, length) == 0) {
+            ++entry->count;
+            return;
+        }
+    }
+    if (c->entryCount == c->entryCapacity) {
+        c->entryCapacity = c->entryCapacity > 0 ? c->entryCapacity * 2 : COUNT_INITIAL_SLOTS;
+        c->entries = realloc(c->entries, sizeof(countEntry) * c->entryCapacity);
+    }
+    c->entries[c->entryCount++] = (countEntry) {arenaCopy(c, text, length), length, 1};
+    c->slots[i] = (countSlot) {hash, c->entryCount};
+}
+
+/**
+ * Add bytes to the line read so far
+ * @param c the counter
+ * @param text bytes to add
+ * @param length amount of bytes
+ */
+static void appendLine(counter *c, const char *text, size_t length) {
+    if (c->lineLength + length > c->lineCapacity) {
+        c->lineCapacity = c->lineLength + length > 2 * c->lineCapacity ? c->lineLength + length : 2 * c->lineCapacity;
+        c->line = realloc(c->line, c->lineCapacity);
+    }
+    memcpy(c->line + c->lineLength, text, length);
+    c->lineLength += length;
+}
+
+/**
+ * Count the lines of one input of count
+ * @param source input to read
+ * @param name name of the input, for errors
+ * @param context the counter
+ * @return false if the input could not be read
+ */
+static bool countInput(stream *source, const char *name, void *context) {
+    counter *const c = context;
+    char *const buffer = malloc(STREAM_BUFFER_SIZE);
+    ssize_t n;
+    while ((n = streamRead(source, buffer, STREAM_BUFFER_SIZE)) > 0) {
+        const char *start = buffer;
+        const char *const end = buffer + n;
+        const char *newline;
+        while ((newline = memchr(start, '\n', (size_t) (end - start))) != NULL) {
+            // Lines within the buffer are counted in place, only those split between reads are copied
+            if (c->lineLength > 0) {
+                appendLine(c, start, (size_t) (newline - start));
+                countLine(c, c->line, c->lineLength);
+                c->lineLength = 0;
+            } else {
+                countLine(c, start, (size_t) (newline - start));
+            }
+            start = newline + 1;
+        }
+        appendLine(c, start, (size_t) (end - start));
+    }
+    free(buffer);
+    // A last line without a newline
+    if (c->lineLength > 0) {
+        countLine(c, c->line, c->lineLength);
+        c->lineLength = 0;
+    }
+    if (n < 0) {
+        fprintf(stderr, "count: %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Order entries bytewise by their lines, for qsort
+ * @param a first entry
+ * @param b second entry
+ * @return negative, zero or positive like memcmp
+ */
+static int compareKeys(const void *a, const void *b) {
+    const countEntry *const x = a;
+    const countEntry *const y = b;
+    const int result = memcmp(x->text, y->text, x->length < y->length ? x->length : y->length);
+    return result != 0 ? result : (x->length > y->length) - (x->length < y->length);
+}
+
+/**
+ * Order entries by descending count, for qsort
+ * @param a first entry
+ * @param b second entry
+ * @return negative, zero or positive like memcmp
+ */
+static int compareCounts(const void *a, const void *b) {
+    const countEntry *const x = a;
+    const countEntry *const y = b;
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+    // Ties in bytewise order of the lines, so the output does not depend on the input order
+    return compareKeys(a, b);
+}
+
+/**
+ * Executes the count command
+ * @param params -s to order lines by descending count rather than first appearance, or -k bytewise by line like
+ * sort | uniq -c, then files to count, - or none for the input
+ * @param in input of the command
+ * @param out output of the command
+ * @return exit status
+ */
+int count(char *params[], stream *in, stream *out) {
+    int (*order)(const void *, const void *) = NULL;
+    for (; *params != NULL && **params == '-' && (*params)[1] != '\0'; ++params) {
+        if (strcmp(*params, "-s") == 0) {
+            order = compareCounts;
+        } else if (strcmp(*params, "-k") == 0) {
+            order = compareKeys;
+        } else {
+            fprintf(stderr, "count: invalid option %s\n", *params);
+            return 2;
+        }
+    }
+
+    counter c = {0};
+    const int status = streamEachInput("count", params, in, out, countInput, &c);
+    if (order != NULL) {
+        qsort(c.entries, c.entryCount, sizeof(countEntry), order);
+    }
+    for (size_t i = 0; i < c.entryCount && !out->failed; ++i) {
+        char prefix[32];
+        const int length = snprintf(prefix, sizeof(prefix), "%7zu ", c.entries[i].count);
+        streamWrite(out, prefix, (size_t) length);
+        streamWrite(out, c.entries[i].text, c.entries[i].length);
+        streamWrite(out, "\n", 1);
+    }
+
+    while (c.arena != NULL) {
+        arenaBlock *const next = c.arena->next;
+        free(c.arena);
+        c.arena = next;
+    }
+    free(c.slots);
+    free(c.entries);
+    free(c.line);
+    return status;
+}
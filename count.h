@@ -0,0 +1,8 @@
+#ifndef ASSIGNMENT1_COUNT_H
+#define ASSIGNMENT1_COUNT_H
+
+#include "stream.h"
+
+int count(char *params[], stream *in, stream *out);
+
+#endif
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "dag.h"
+#include "eventloop.h"
+#include "jobs.h"
+#include "spawn.h"
+#include "stats.h"
+#include "tokenizer.h"
+
+/**
+ * dag [-j jobs] file, runs a graph of commands with as much parallelism as the dependencies allow.
+ * Each line of the file is "name: dependency...: command", blank lines and lines starting with # are ignored.
+ * Running commands are background jobs in the job table, a command whose dependency failed is skipped.
+ */
+
+typedef enum dagState {
+    DAG_WAITING,
+    DAG_RUNNING,
+    DAG_SUCCEEDED,
+    DAG_FAILED,
+    DAG_SKIPPED,
+} dagState;
+
+typedef struct dagNode {
+    char *name;
+    // Names of the dependencies as written, and their indexes once the whole file is read
+    char **dependencyNames;
+    int *dependencies;
+    int dependencyCount;
+    // Command line, handed over to the job table once the command starts
+    char *buffer;
+    char *args[ARGS_SIZE + 1];
+    char *outputRedirection;
+    int cmdPipeIndex;
+    dagState state;
+    job *job;
+} dagNode;
+
+typedef struct dag {
+    dagNode *nodes;
+    int count;
+} dag;
+
+/**
+ * Find a node by name
+ * @param graph graph to search
+ * @param name name of the node
+ * @return index of the node, -1 if there is none
+ */
+static int findDagNode(const dag *const graph, const char *name) {
+    for (int i = 0; i < graph->count; ++i) {
+        if (strcmp(graph->nodes[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Free a graph and every node that was not handed over to the job table
+ * @param graph graph to free
+ */
+static void freeDag(dag *const graph) {
+    for (int i = 0; i < graph->count; ++i) {
+        free(graph->nodes[i].name);
+        for (int d = 0; d < graph->nodes[i].dependencyCount; ++d) {
+            free(graph->nodes[i].dependencyNames[d]);
+        }
+        free(graph->nodes[i].dependencyNames);
+        free(graph->nodes[i].dependencies);
+        free(graph->nodes[i].buffer);
+    }
+    free(graph->nodes);
+}
+
+/**
+ * Trim whitespace from both ends of a string, in place
+ * @param text string to trim
+ * @return the trimmed string
+ */
+static char *trim(char *text) {
+    while (*text == ' ' || *text == '\t') {
+        ++text;
+    }
+    size_t length = strlen(text);
+    while (length > 0 && (text[length - 1] == ' ' || text[length - 1] == '\t' || text[length - 1] == '\n')) {
+        text[--length] = '\0';
+    }
+    return text;
+}
+
+/**
+ * Parse one line of a graph description into a new node
+ * @param graph graph to add the node to
+ * @param line line of the file, modified in place
+ * @param lineNumber line number, for errors
+ * @return true if the line was valid
+ */
+static bool parseDagLine(dag *const graph, char *line, int lineNumber) {
+    char *const nameEnd = strchr(line, ':');
+    char *const dependenciesEnd = nameEnd != NULL ? strchr(nameEnd + 1, ':') : NULL;
+    if (dependenciesEnd == NULL) {
+        fprintf(stderr, "dag: line %d: expected name: dependencies: command\n", lineNumber);
+        return false;
+    }
+    *nameEnd = '\0';
+    *dependenciesEnd = '\0';
+    char *const name = trim(line);
+    char *const command = trim(dependenciesEnd + 1);
+    if (*name == '\0' || *command == '\0') {
+        fprintf(stderr, "dag: line %d: missing name or command\n", lineNumber);
+        return false;
+    }
+    if (findDagNode(graph, name) >= 0) {
+        fprintf(stderr, "dag: line %d: %s is defined twice\n", lineNumber, name);
+        return false;
+    }
+
+    graph->nodes = realloc(graph->nodes, sizeof(dagNode) * (size_t) (graph->count + 1));
+    dagNode *const n = &graph->nodes[graph->count++];
+    memset(n, 0, sizeof(dagNode));
+    n->name = strdup(name);
+    char *dependencies = nameEnd + 1;
+    char *dependency;
+    while ((dependency = strsep(&dependencies, " \t")) != NULL) {
+        if (*dependency != '\0') {
+            n->dependencyNames = realloc(n->dependencyNames, sizeof(char *) * (size_t) (n->dependencyCount + 1));
+            n->dependencyNames[n->dependencyCount++] = strdup(dependency);
+        }
+    }
+
+    n->buffer = strdup(command);
+    bool background;
+    const int length = getcmd(n->buffer, (ssize_t) strlen(n->buffer) - 1, n->args, &background,
+                              &n->outputRedirection, &n->cmdPipeIndex);
+    if (length < 1 || length > ARGS_SIZE) {
+        fprintf(stderr, "dag: line %d: invalid command\n", lineNumber);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read a graph description
+ * @param path file to read
+ * @param graph graph to be populated
+ * @return true if the file was read and every dependency exists
+ */
+static bool readDag(const char *path, dag *const graph) {
+    FILE *const file = fopen(path, "r");
+    if (file == NULL) {
+        perror("dag");
+        return false;
+    }
+
+    char *line = NULL;
+    size_t size = 0;
+    int lineNumber = 0;
+    bool ok = true;
+    while (ok && getline(&line, &size, file) >= 0) {
+        ++lineNumber;
+        char *const text = trim(line);
+        if (*text != '\0' && *text != '#') {
+            ok = parseDagLine(graph, text, lineNumber);
+        }
+    }
+    free(line);
+    fclose(file);
+
+    // Dependencies may be defined later in the file, so they are resolved once every node is known
+    for (int i = 0; ok && i < graph->count; ++i) {
+        dagNode *const n = &graph->nodes[i];
+        n->dependencies = malloc(sizeof(int) * (size_t) (n->dependencyCount + 1));
+        for (int d = 0; ok && d < n->dependencyCount; ++d) {
+            n->dependencies[d] = findDagNode(graph, n->dependencyNames[d]);
+            if (n->dependencies[d] < 0) {
+                fprintf(stderr, "dag: %s depends on unknown %s\n", n->name, n->dependencyNames[d]);
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+/**
+ * Decide what a waiting node can do
+ * @param graph the graph
+ * @param n node to check
+ * @return DAG_RUNNING if it can start, DAG_SKIPPED if a dependency did not succeed, DAG_WAITING otherwise
+ */
+static dagState readiness(const dag *const graph, const dagNode *const n) {
+    dagState result = DAG_RUNNING;
+    for (int d = 0; d < n->dependencyCount; ++d) {
+        const dagState state = graph->nodes[n->dependencies[d]].state;
+        if (state == DAG_FAILED || state == DAG_SKIPPED) {
+            return DAG_SKIPPED;
+        }
+        if (state != DAG_SUCCEEDED) {
+            result = DAG_WAITING;
+        }
+    }
+    return result;
+}
+
+/**
+ * Run every node of a graph, at most limit at once
+ * @param graph graph to run
+ * @param limit maximum amount of commands running at once
+ */
+static void runDag(dag *const graph, int limit) {
+    int running = 0;
+    int finished = 0;
+    while (finished < graph->count) {
+        bool progress = false;
+        for (int i = 0; i < graph->count; ++i) {
+            dagNode *const n = &graph->nodes[i];
+            if (n->state == DAG_RUNNING && n->job->state == JOB_DONE) {
+                const int status = n->job->status;
+                n->state = WIFEXITED(status) && WEXITSTATUS(status) == 0 ? DAG_SUCCEEDED : DAG_FAILED;
+                if (n->state == DAG_FAILED) {
+                    fprintf(stderr, "dag: %s failed\n", n->name);
+                }
+                removeJob(n->job);
+                n->job = NULL;
+                --running;
+                ++finished;
+                progress = true;
+            }
+        }
+        for (int i = 0; i < graph->count; ++i) {
+            dagNode *const n = &graph->nodes[i];
+            if (n->state != DAG_WAITING) {
+                continue;
+            }
+            const dagState next = readiness(graph, n);
+            if (next == DAG_SKIPPED) {
+                fprintf(stderr, "dag: %s skipped\n", n->name);
+                n->state = DAG_SKIPPED;
+                ++finished;
+                progress = true;
+            } else if (next == DAG_RUNNING && running < limit) {
+                int pidfd;
+                const pid_t pid = spawnCommand(n->args, n->outputRedirection, n->cmdPipeIndex, 0, &pidfd);
+                if (pid < 0) {
+                    perror("dag");
+                    n->state = DAG_FAILED;
+                    ++finished;
+                } else {
+                    n->job = addNode(n->buffer, pid);
+                    n->job->name = *n->args;
+                    n->job->pidfd = pidfd;
+                    n->buffer = NULL;
+                    n->state = DAG_RUNNING;
+                    STAT_ADD(jobsLaunched, 1);
+                    ++running;
+                }
+                progress = true;
+            }
+        }
+
+        if (running > 0) {
+            eventLoopRunOnce();
+        } else if (!progress && finished < graph->count) {
+            fprintf(stderr, "dag: dependency cycle, %d commands cannot run\n", graph->count - finished);
+            return;
+        }
+    }
+
+    int counts[DAG_SKIPPED + 1] = {0};
+    for (int i = 0; i < graph->count; ++i) {
+        ++counts[graph->nodes[i].state];
+    }
+    printf("dag: %d succeeded, %d failed, %d skipped\n", counts[DAG_SUCCEEDED], counts[DAG_FAILED],
+           counts[DAG_SKIPPED]);
+}
+
+/**
+ * Executes the dag command
+ * @param params parameters for command, [-j jobs] file
+ */
+void runDagCommand(char *params[]) {
+    long limit = sysconf(_SC_NPROCESSORS_ONLN);
+    if (*params != NULL && strcmp(*params, "-j") == 0) {
+        limit = params[1] != NULL ? strtol(params[1], NULL, 10) : 0;
+        params += 2;
+    }
+    if (limit < 1 || *params == NULL || params[1] != NULL) {
+        fprintf(stderr, "dag: usage: dag [-j jobs] file\n");
+        return;
+    }
+
+    dag graph = {NULL, 0};
+    if (readDag(*params, &graph)) {
+        runDag(&graph, (int) limit);
+    }
+    freeDag(&graph);
+}
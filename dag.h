@@ -0,0 +1,6 @@
+#ifndef ASSIGNMENT1_DAG_H
+#define ASSIGNMENT1_DAG_H
+
+void runDagCommand(char *params[]);
+
+#endif
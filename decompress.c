@@ -0,0 +1,183 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decompress.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/**
+ * Decompressing stream builtins, zcat for gzip (and zlib) data and zstdcat for zstd data, each only built
+ * when its library is found. Concatenated members or frames are decoded one after the other, like the
+ * standard tools. The only option they take is -c, writing to stdout as they always do, any other option
+ * runs the system tool.
+ */
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+
+/**
+ * Skip the options of zcat or zstdcat
+ * @param params parameters of the command
+ * @return the files named after the options
+ */
+static char **skipOptions(char *params[]) {
+    while (*params != NULL && strcmp(*params, "-c") == 0) {
+        ++params;
+    }
+    return params;
+}
+
+#endif
+
+#ifdef HAVE_ZLIB
+
+/**
+ * Decompress one gzip input of zcat to its output
+ * @param source input to decompress
+ * @param name name of the input, for errors
+ * @param context output stream
+ * @return false if the input could not be read or is not valid gzip data
+ */
+static bool zcatInput(stream *source, const char *name, void *context) {
+    stream *const out = context;
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    // 32 lets zlib detect gzip or zlib headers
+    if (inflateInit2(&z, 15 + 32) != Z_OK) {
+        fprintf(stderr, "zcat: %s: out of memory\n", name);
+        return false;
+    }
+
+    unsigned char *const input = malloc(STREAM_BUFFER_SIZE);
+    unsigned char *const output = malloc(STREAM_BUFFER_SIZE);
+    bool ok = true;
+    // True while part of a member has been read but not its end
+    bool inMember = false;
+    int members = 0;
+    ssize_t n = 0;
+    while (!out->failed) {
+        if (z.avail_in == 0) {
+            if ((n = streamRead(source, input, STREAM_BUFFER_SIZE)) <= 0) {
+                break;
+            }
+            z.next_in = input;
+            z.avail_in = (uInt) n;
+        }
+        z.next_out = output;
+        z.avail_out = STREAM_BUFFER_SIZE;
+        const int result = inflate(&z, Z_NO_FLUSH);
+        if (result == Z_DATA_ERROR && !inMember && members > 0) {
+            fprintf(stderr, "zcat: %s: trailing garbage ignored\n", name);
+            break;
+        }
+        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+            fprintf(stderr, "zcat: %s: %s\n", name, z.msg != NULL ? z.msg : "invalid compressed data");
+            ok = false;
+            break;
+        }
+        inMember = result != Z_STREAM_END;
+        if (result == Z_STREAM_END) {
+            ++members;
+            inflateReset(&z);
+        }
+        streamWrite(out, output, STREAM_BUFFER_SIZE - z.avail_out);
+    }
+    if (n < 0) {
+        fprintf(stderr, "zcat: %s: %s\n", name, strerror(errno));
+        ok = false;
+    } else if (ok && inMember && !out->failed) {
+        fprintf(stderr, "zcat: %s: unexpected end of file\n", name);
+        ok = false;
+    }
+    inflateEnd(&z);
+    free(input);
+    free(output);
+    return ok;
+}
+
+/**
+ * Executes the zcat command
+ * @param params -c, then gzip files to decompress to the output, - or none for the input
+ * @param in input of the command
+ * @param out output of the command
+ * @return exit status
+ */
+int zcat(char *params[], stream *in, stream *out) {
+    return streamEachInput("zcat", skipOptions(params), in, out, zcatInput, out);
+}
+
+#endif
+
+#ifdef HAVE_ZSTD
+
+/**
+ * Decompress one zstd input of zstdcat to its output
+ * @param source input to decompress
+ * @param name name of the input, for errors
+ * @param context output stream
+ * @return false if the input could not be read or is not valid zstd data
+ */
+static bool zstdcatInput(stream *source, const char *name, void *context) {
+    stream *const out = context;
+    ZSTD_DStream *const decoder = ZSTD_createDStream();
+    if (decoder == NULL || ZSTD_isError(ZSTD_initDStream(decoder))) {
+        fprintf(stderr, "zstdcat: %s: out of memory\n", name);
+        ZSTD_freeDStream(decoder);
+        return false;
+    }
+
+    // Buffers of the sizes zstd recommends, so whole blocks are decoded at once
+    const size_t inputSize = ZSTD_DStreamInSize();
+    const size_t outputSize = ZSTD_DStreamOutSize();
+    char *const input = malloc(inputSize);
+    char *const output = malloc(outputSize);
+    ZSTD_inBuffer in = {input, 0, 0};
+    bool ok = true;
+    // Non-zero while a frame has not been fully decoded
+    size_t pending = 0;
+    ssize_t n = 0;
+    while (!out->failed) {
+        if (in.pos == in.size) {
+            if ((n = streamRead(source, input, inputSize)) <= 0) {
+                break;
+            }
+            in = (ZSTD_inBuffer) {input, (size_t) n, 0};
+        }
+        ZSTD_outBuffer result = {output, outputSize, 0};
+        pending = ZSTD_decompressStream(decoder, &result, &in);
+        if (ZSTD_isError(pending)) {
+            fprintf(stderr, "zstdcat: %s: %s\n", name, ZSTD_getErrorName(pending));
+            ok = false;
+            break;
+        }
+        streamWrite(out, output, result.pos);
+    }
+    if (n < 0) {
+        fprintf(stderr, "zstdcat: %s: %s\n", name, strerror(errno));
+        ok = false;
+    } else if (ok && pending != 0 && !out->failed) {
+        fprintf(stderr, "zstdcat: %s: unexpected end of file\n", name);
+        ok = false;
+    }
+    ZSTD_freeDStream(decoder);
+    free(input);
+    free(output);
+    return ok;
+}
+
+/**
+ * Executes the zstdcat command
+ * @param params -c, then zstd files to decompress to the output, - or none for the input
+ * @param in input of the command
+ * @param out output of the command
+ * @return exit status
+ */
+int zstdcat(char *params[], stream *in, stream *out) {
+    return streamEachInput("zstdcat", skipOptions(params), in, out, zstdcatInput, out);
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef ASSIGNMENT1_DECOMPRESS_H
+#define ASSIGNMENT1_DECOMPRESS_H
+
+#include "stream.h"
+
+#ifdef HAVE_ZLIB
+int zcat(char *params[], stream *in, stream *out);
+#endif
+
+#ifdef HAVE_ZSTD
+int zstdcat(char *params[], stream *in, stream *out);
+#endif
+
+#endif
@@ -0,0 +1,575 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "eventloop.h"
+
+/**
+ * Single threaded event loop, it only runs while the shell would otherwise block,
+ * i.e. waiting for a line of input or for a foreground child to exit.
+ * Child state changes are turned into fd readiness with a SIGCHLD self-pipe.
+ * Readiness comes from io_uring when the kernel allows it: one-shot polls, reads and timeouts are queued as
+ * SQEs, submitted and harvested with a single io_uring_enter per wait. Otherwise epoll is used, with
+ * ASSIGNMENT1_EVENT_LOOP=epoll forcing it.
+ */
+
+#define EVENT_LOOP_MAX_FDS 64
+#define RING_ENTRIES 128
+
+// Kinds of io_uring requests, kept in the top byte of their user data
+#define TOKEN_WATCH 1ULL
+#define TOKEN_CHILD 2ULL
+#define TOKEN_EXTRA 3ULL
+#define TOKEN_READ 4ULL
+#define TOKEN_IGNORE 5ULL
+#define TOKEN_KIND(token) ((token) >> 56)
+
+typedef struct watch {
+    int fd;
+    // POLLIN or POLLOUT
+    short events;
+    eventHandler handler;
+    void *context;
+    // io_uring poll queued for the fd, 0 if none
+    uint64_t token;
+} watch;
+
+typedef struct ring {
+    int fd;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned sqEntries;
+    struct io_uring_sqe *sqes;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+    // SQEs queued since the last io_uring_enter
+    unsigned toSubmit;
+} ring;
+
+static watch watches[EVENT_LOOP_MAX_FDS];
+static int watchCount = 0;
+static int childPipe[2] = {-1, -1};
+static void (*childHandler)(void) = NULL;
+// Set by the signal handler, saves a read of the self-pipe when no child changed state
+static volatile sig_atomic_t childSignalled = 0;
+
+static ring uring = {.fd = -1};
+static int epollFd = -1;
+static uint64_t nextToken = 1;
+// Queued polls of the self-pipe and of the fd waited for without a handler, 0 if none
+static uint64_t childToken = 0;
+static uint64_t extraToken = 0;
+static int extraFd = -1;
+// epoll refuses regular files, which are always readable, so the extra fd is reported without polling it
+static bool extraAlwaysReady = false;
+// Queued read and its result, once complete
+static uint64_t readToken = 0;
+static bool readDone = false;
+static ssize_t readResult = 0;
+
+/**
+ * Handler for SIGCHLD signal, wakes up the event loop
+ * @param sig Signal code
+ */
+static void childSignalHandler(int sig) {
+    (void) sig;
+    const int savedErrno = errno;
+    childSignalled = 1;
+    write(childPipe[1], "", 1);
+    errno = savedErrno;
+}
+
+/**
+ * Set up an io_uring instance
+ * @return true if the ring can be used
+ */
+static bool uringInit(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    const int fd = (int) syscall(SYS_io_uring_setup, RING_ENTRIES, &params);
+    if (fd < 0) {
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(fd);
+        return false;
+    }
+
+    size_t ringSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    const size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ringSize = cqSize > ringSize ? cqSize : ringSize;
+    char *const rings = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                             IORING_OFF_SQ_RING);
+    if (rings == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    struct io_uring_sqe *const sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                                           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        munmap(rings, ringSize);
+        close(fd);
+        return false;
+    }
+
+    uring = (ring) {
+            .fd = fd,
+            .sqHead = (unsigned *) (rings + params.sq_off.head),
+            .sqTail = (unsigned *) (rings + params.sq_off.tail),
+            .sqMask = (unsigned *) (rings + params.sq_off.ring_mask),
+            .sqArray = (unsigned *) (rings + params.sq_off.array),
+            .sqEntries = params.sq_entries,
+            .sqes = sqes,
+            .cqHead = (unsigned *) (rings + params.cq_off.head),
+            .cqTail = (unsigned *) (rings + params.cq_off.tail),
+            .cqMask = (unsigned *) (rings + params.cq_off.ring_mask),
+            .cqes = (struct io_uring_cqe *) (rings + params.cq_off.cqes),
+            .toSubmit = 0,
+    };
+    return true;
+}
+
+/**
+ * Submit the queued SQEs, optionally waiting for a completion
+ * @param wait true to block until at least one CQE is available
+ */
+static void uringEnter(bool wait) {
+    const int submitted = (int) syscall(SYS_io_uring_enter, uring.fd, uring.toSubmit, wait ? 1 : 0,
+                                        wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (submitted > 0) {
+        uring.toSubmit -= (unsigned) submitted;
+    }
+}
+
+/**
+ * Queue a SQE, submitting the queue first if it is full
+ * @param opcode operation
+ * @param fd fd operated on
+ * @param token user data identifying the request
+ * @return the SQE, to be filled in further
+ */
+static struct io_uring_sqe *uringQueue(uint8_t opcode, int fd, uint64_t token) {
+    unsigned tail = *uring.sqTail;
+    while (tail - __atomic_load_n(uring.sqHead, __ATOMIC_ACQUIRE) >= uring.sqEntries) {
+        uringEnter(false);
+    }
+    const unsigned index = tail & *uring.sqMask;
+    struct io_uring_sqe *const sqe = &uring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = token;
+    uring.sqArray[index] = index;
+    __atomic_store_n(uring.sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++uring.toSubmit;
+    return sqe;
+}
+
+/**
+ * Queue a one-shot poll, it reports readiness already present when queued
+ * @param fd fd to poll
+ * @param kind kind of request, TOKEN_WATCH, TOKEN_CHILD or TOKEN_EXTRA
+ * @param events POLLIN or POLLOUT
+ * @return token of the poll
+ */
+static uint64_t uringPoll(int fd, uint64_t kind, short events) {
+    const uint64_t token = kind << 56 | nextToken++;
+    uringQueue(IORING_OP_POLL_ADD, fd, token)->poll32_events = (uint32_t) events;
+    return token;
+}
+
+/**
+ * Cancel a queued poll, its completion is then ignored
+ * @param token token of the poll
+ */
+static void uringCancel(uint64_t token) {
+    uringQueue(IORING_OP_POLL_REMOVE, -1, TOKEN_IGNORE << 56)->addr = token;
+}
+
+/**
+ * Submit the queued requests and wait for completions
+ * @param fd extra fd to poll for readability without a handler, -1 for none
+ * @param timeout timeout in milliseconds, -1 to wait forever
+ * @param ready array to be populated with the ready fds
+ * @return amount of ready fds
+ */
+static int uringWait(int fd, int timeout, int *ready) {
+    for (int i = 0; i < watchCount; ++i) {
+        if (watches[i].token == 0) {
+            watches[i].token = uringPoll(watches[i].fd, TOKEN_WATCH, watches[i].events);
+        }
+    }
+    if (childToken == 0) {
+        childToken = uringPoll(childPipe[0], TOKEN_CHILD, POLLIN);
+    }
+    if (fd >= 0 && extraToken != 0 && extraFd != fd) {
+        uringCancel(extraToken);
+        extraToken = 0;
+    }
+    if (fd >= 0 && extraToken == 0) {
+        extraToken = uringPoll(fd, TOKEN_EXTRA, POLLIN);
+        extraFd = fd;
+    }
+    if (timeout >= 0) {
+        // Completes after the timeout or as soon as anything else completes, whichever is first
+        static struct __kernel_timespec ts;
+        ts = (struct __kernel_timespec) {timeout / 1000, (long long) (timeout % 1000) * 1000000};
+        struct io_uring_sqe *const sqe = uringQueue(IORING_OP_TIMEOUT, -1, TOKEN_IGNORE << 56);
+        sqe->addr = (uint64_t) (uintptr_t) &ts;
+        sqe->len = 1;
+        sqe->off = 1;
+    }
+    uringEnter(true);
+
+    int count = 0;
+    unsigned head = *uring.cqHead;
+    const unsigned tail = __atomic_load_n(uring.cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe *const cqe = &uring.cqes[head & *uring.cqMask];
+        const uint64_t token = cqe->user_data;
+        const bool readable = cqe->res > 0;
+        switch (TOKEN_KIND(token)) {
+            case TOKEN_WATCH:
+                for (int i = 0; i < watchCount; ++i) {
+                    if (watches[i].token == token) {
+                        watches[i].token = 0;
+                        if (readable) {
+                            ready[count++] = watches[i].fd;
+                        }
+                        break;
+                    }
+                }
+                break;
+            case TOKEN_CHILD:
+                childToken = 0;
+                if (readable) {
+                    ready[count++] = childPipe[0];
+                }
+                break;
+            case TOKEN_EXTRA:
+                // Readiness seen while nobody asked for it may be stale, the fd is polled again when wanted
+                if (token == extraToken) {
+                    extraToken = 0;
+                    if (readable && extraFd == fd) {
+                        ready[count++] = fd;
+                    }
+                }
+                break;
+            case TOKEN_READ:
+                if (token == readToken) {
+                    readToken = 0;
+                    readDone = true;
+                    readResult = cqe->res;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    __atomic_store_n(uring.cqHead, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+/**
+ * Wait for readiness with epoll
+ * @param fd extra fd to poll for readability without a handler, -1 for none
+ * @param timeout timeout in milliseconds, -1 to wait forever
+ * @param ready array to be populated with the ready fds
+ * @return amount of ready fds
+ */
+static int epollWait(int fd, int timeout, int *ready) {
+    // The extra fd is one-shot, so it cannot wake the loop again while only children are waited for
+    if (fd >= 0 && extraFd != fd) {
+        if (extraFd >= 0 && !extraAlwaysReady) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, extraFd, NULL);
+        }
+        struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.fd = fd};
+        extraAlwaysReady = epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0 && errno == EPERM;
+        extraFd = fd;
+        extraToken = 1;
+    } else if (fd >= 0 && extraToken == 0 && !extraAlwaysReady) {
+        struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.fd = fd};
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+        extraToken = 1;
+    }
+
+    int count = 0;
+    if (fd >= 0 && extraAlwaysReady) {
+        // Only collect what the watched fds have ready, without blocking
+        ready[count++] = fd;
+        timeout = 0;
+    }
+    struct epoll_event events[EVENT_LOOP_MAX_FDS + 2];
+    const int n = epoll_wait(epollFd, events, EVENT_LOOP_MAX_FDS + 2, timeout);
+    for (int i = 0; i < n; ++i) {
+        if (events[i].data.fd == extraFd) {
+            extraToken = 0;
+            if (extraFd != fd) {
+                continue;
+            }
+        }
+        ready[count++] = events[i].data.fd;
+    }
+    return count;
+}
+
+/**
+ * Create the self-pipe, the io_uring or epoll instance and install the SIGCHLD handler, the first time
+ * @return true if the loop is ready
+ */
+static bool eventLoopInit(void) {
+    if (childPipe[0] >= 0) {
+        return true;
+    }
+    if (pipe(childPipe)) {
+        return false;
+    }
+    for (int i = 0; i < 2; ++i) {
+        fcntl(childPipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(childPipe[i], F_SETFL, O_NONBLOCK);
+    }
+
+    const char *const backend = getenv("ASSIGNMENT1_EVENT_LOOP");
+    if (backend == NULL || strcmp(backend, "epoll") != 0) {
+        uringInit();
+    }
+    if (uring.fd < 0) {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        struct epoll_event event = {.events = EPOLLIN, .data.fd = childPipe[0]};
+        if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, childPipe[0], &event)) {
+            return false;
+        }
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = childSignalHandler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    return sigaction(SIGCHLD, &action, NULL) == 0;
+}
+
+/**
+ * Set the function called whenever a child may have changed state
+ * @param handler function to call, e.g. to reap background jobs
+ */
+void eventLoopSetChildHandler(void (*handler)(void)) {
+    childHandler = handler;
+    eventLoopInit();
+}
+
+/**
+ * Call the child handler if SIGCHLD arrived since the last check
+ */
+void eventLoopCheckChildren(void) {
+    if (!childSignalled) {
+        return;
+    }
+    childSignalled = 0;
+    char drain[64];
+    while (read(childPipe[0], drain, sizeof(drain)) > 0);
+    if (childHandler != NULL) {
+        childHandler();
+    }
+}
+
+/**
+ * Watch a fd for readiness
+ * @param fd fd to watch
+ * @param events POLLIN or POLLOUT
+ * @param handler function to call when fd is ready
+ * @param context passed to the handler
+ * @return true if the fd is now being watched
+ */
+static bool watchAdd(int fd, short events, eventHandler handler, void *context) {
+    if (watchCount == EVENT_LOOP_MAX_FDS || !eventLoopInit()) {
+        return false;
+    }
+    if (epollFd >= 0) {
+        struct epoll_event event = {.events = events == POLLOUT ? EPOLLOUT : EPOLLIN, .data.fd = fd};
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event)) {
+            return false;
+        }
+    }
+    watches[watchCount++] = (watch) {fd, events, handler, context, 0};
+    return true;
+}
+
+/**
+ * Watch a fd, handler is called whenever it is readable (or has hung up)
+ * @param fd fd to watch
+ * @param handler function to call when fd is readable
+ * @param context passed to the handler
+ * @return true if the fd is now being watched
+ */
+bool eventLoopAdd(int fd, eventHandler handler, void *context) {
+    return watchAdd(fd, POLLIN, handler, context);
+}
+
+/**
+ * Watch a fd, handler is called whenever it is writable (or has hung up)
+ * @param fd fd to watch, it must not be watched for readability at the same time
+ * @param handler function to call when fd is writable
+ * @param context passed to the handler
+ * @return true if the fd is now being watched
+ */
+bool eventLoopAddWritable(int fd, eventHandler handler, void *context) {
+    return watchAdd(fd, POLLOUT, handler, context);
+}
+
+/**
+ * Stop watching a fd
+ * @param fd fd to stop watching
+ */
+void eventLoopRemove(int fd) {
+    for (int i = 0; i < watchCount; ++i) {
+        if (watches[i].fd == fd) {
+            if (watches[i].token != 0) {
+                uringCancel(watches[i].token);
+            }
+            if (epollFd >= 0) {
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+            }
+            watches[i] = watches[--watchCount];
+            return;
+        }
+    }
+}
+
+/**
+ * @return true if any fd is being watched, otherwise the shell can simply block
+ */
+bool eventLoopActive(void) {
+    return watchCount > 0;
+}
+
+/**
+ * Wait once for the watched fds, dispatching their handlers
+ * @param fd extra fd to poll for readability without a handler, -1 for none
+ * @param timeout timeout in milliseconds, -1 to wait forever
+ * @return true if fd is readable
+ */
+static bool eventLoopPoll(int fd, int timeout) {
+    int ready[EVENT_LOOP_MAX_FDS + 2];
+    const int count = uring.fd >= 0 ? uringWait(fd, timeout, ready) : epollWait(fd, timeout, ready);
+
+    bool readable = false;
+    for (int i = 0; i < count; ++i) {
+        if (ready[i] == fd) {
+            readable = true;
+            continue;
+        }
+        if (ready[i] == childPipe[0]) {
+            eventLoopCheckChildren();
+            continue;
+        }
+        // Handlers may add or remove watches, so look each one up again
+        for (int w = 0; w < watchCount; ++w) {
+            if (watches[w].fd == ready[i]) {
+                watches[w].handler(watches[w].fd, watches[w].context);
+                break;
+            }
+        }
+    }
+    return readable;
+}
+
+/**
+ * Run the event loop until something happens, e.g. a child changes state
+ */
+void eventLoopRunOnce(void) {
+    eventLoopPoll(-1, -1);
+}
+
+/**
+ * Run the event loop until fd is readable
+ * @param fd fd to wait for
+ */
+void eventLoopWaitReadable(int fd) {
+    while (!eventLoopPoll(fd, -1));
+}
+
+/**
+ * Read from fd, running the event loop until the data arrives.
+ * With io_uring the read itself is queued, so waiting and reading take a single system call.
+ * @param fd fd to read from
+ * @param buffer buffer to be populated
+ * @param size size of the buffer
+ * @return result of the read, -1 with errno set on failure
+ */
+ssize_t eventLoopRead(int fd, void *buffer, size_t size) {
+    if (uring.fd < 0) {
+        eventLoopWaitReadable(fd);
+        return read(fd, buffer, size);
+    }
+
+    readDone = false;
+    readToken = TOKEN_READ << 56 | nextToken++;
+    struct io_uring_sqe *const sqe = uringQueue(IORING_OP_READ, fd, readToken);
+    sqe->addr = (uint64_t) (uintptr_t) buffer;
+    sqe->len = (unsigned) size;
+    // Read from the current file position, like read(2)
+    sqe->off = (uint64_t) -1;
+    while (!readDone) {
+        eventLoopPoll(-1, -1);
+    }
+    if (readResult < 0) {
+        errno = (int) -readResult;
+        return -1;
+    }
+    return readResult;
+}
+
+/**
+ * Run the event loop until fd is readable or the timeout expires
+ * @param fd fd to wait for
+ * @param timeout timeout in milliseconds
+ * @return true if fd is readable
+ */
+bool eventLoopWaitReadableFor(int fd, int timeout) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const long long deadline = (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000 + timeout;
+    while (1) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const long long remaining = deadline - ((long long) now.tv_sec * 1000 + now.tv_nsec / 1000000);
+        if (remaining <= 0) {
+            return false;
+        }
+        if (eventLoopPoll(fd, (int) remaining)) {
+            return true;
+        }
+    }
+}
+
+/**
+ * Run the event loop until the child changes state, like wait4
+ * @param pid pid of the child
+ * @param status pointer to be populated with the status of the child
+ * @param options waitpid options
+ * @param usage pointer to be populated with the resource usage of the child, may be NULL
+ * @return result of wait4
+ */
+pid_t eventLoopWaitChild(pid_t pid, int *status, int options, struct rusage *usage) {
+    while (1) {
+        const pid_t result = wait4(pid, status, options | WNOHANG, usage);
+        if (result != 0) {
+            return result;
+        }
+        eventLoopPoll(-1, -1);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef ASSIGNMENT1_EVENTLOOP_H
+#define ASSIGNMENT1_EVENTLOOP_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+typedef void (*eventHandler)(int fd, void *context);
+
+void eventLoopSetChildHandler(void (*handler)(void));
+
+void eventLoopCheckChildren(void);
+
+bool eventLoopAdd(int fd, eventHandler handler, void *context);
+
+bool eventLoopAddWritable(int fd, eventHandler handler, void *context);
+
+void eventLoopRemove(int fd);
+
+bool eventLoopActive(void);
+
+void eventLoopRunOnce(void);
+
+void eventLoopWaitReadable(int fd);
+
+ssize_t eventLoopRead(int fd, void *buffer, size_t size);
+
+bool eventLoopWaitReadableFor(int fd, int timeout);
+
+pid_t eventLoopWaitChild(pid_t pid, int *status, int options, struct rusage *usage);
+
+#endif
@@ -0,0 +1,239 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fields.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * The fields stream builtin, printing selected columns of every line like cut -f or awk '{print $N}'.
+ * Delimiters are searched 16 bytes at a time with SSE2 where it is available, with a scalar loop for the rest.
+ */
+
+typedef struct fieldRange {
+    size_t first;
+    size_t last;
+} fieldRange;
+
+typedef struct fieldSelection {
+    stream *out;
+    // Delimiter of the fields, '\0' for runs of spaces and tabs
+    char delimiter;
+    fieldRange *ranges;
+    size_t rangeCount;
+    // Fields after this one are never printed
+    size_t lastField;
+} fieldSelection;
+
+/**
+ * @param c byte of a line
+ * @param delimiter delimiter of the fields, '\0' for spaces and tabs
+ * @return true if the byte separates fields
+ */
+static bool isSeparator(char c, char delimiter) {
+    return delimiter != '\0' ? c == delimiter : c == ' ' || c == '\t';
+}
+
+/**
+ * Find the end of a field
+ * @param p start of the field
+ * @param end end of the line
+ * @param delimiter delimiter of the fields, '\0' for spaces and tabs
+ * @return the first separator from p, end if there is none
+ */
+static const char *findSeparator(const char *p, const char *end, char delimiter) {
+#ifdef __SSE2__
+    const __m128i wanted = _mm_set1_epi8(delimiter != '\0' ? delimiter : ' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    while (end - p >= 16) {
+        const __m128i bytes = _mm_loadu_si128((const __m128i *) p);
+        __m128i matches = _mm_cmpeq_epi8(bytes, wanted);
+        if (delimiter == '\0') {
+            matches = _mm_or_si128(matches, _mm_cmpeq_epi8(bytes, tab));
+        }
+        const int mask = _mm_movemask_epi8(matches);
+        if (mask != 0) {
+            return p + __builtin_ctz((unsigned int) mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && !isSeparator(*p, delimiter)) {
+        ++p;
+    }
+    return p;
+}
+
+/**
+ * @param selection the selected fields
+ * @param field number of a field, from 1
+ * @return true if the field is selected
+ */
+static bool isSelected(const fieldSelection *selection, size_t field) {
+    for (size_t i = 0; i < selection->rangeCount; ++i) {
+        if (field >= selection->ranges[i].first && field <= selection->ranges[i].last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Print the selected fields of a line, separated by the delimiter (a space for whitespace separated fields)
+ * @param selection the selected fields
+ * @param line start of the line
+ * @param end end of the line, without its newline
+ */
+static void printFields(const fieldSelection *selection, const char *line, const char *end) {
+    const char delimiter = selection->delimiter;
+    const char separator = delimiter != '\0' ? delimiter : ' ';
+    bool printed = false;
+    const char *p = line;
+    // Like cut, lines without the delimiter come out whole
+    if (delimiter != '\0' && findSeparator(line, end, delimiter) == end) {
+        streamWrite(selection->out, line, (size_t) (end - line));
+        streamWrite(selection->out, "\n", 1);
+        return;
+    }
+    for (size_t field = 1; field <= selection->lastField; ++field) {
+        if (delimiter == '\0') {
+            while (p < end && isSeparator(*p, delimiter)) {
+                ++p;
+            }
+            if (p == end) {
+                break;
+            }
+        }
+        const char *const next = findSeparator(p, end, delimiter);
+        if (isSelected(selection, field)) {
+            if (printed) {
+                streamWrite(selection->out, &separator, 1);
+            }
+            streamWrite(selection->out, p, (size_t) (next - p));
+            printed = true;
+        }
+        if (next == end) {
+            break;
+        }
+        p = next + 1;
+    }
+    streamWrite(selection->out, "\n", 1);
+}
+
+/**
+ * Print the selected fields of one input of fields
+ * @param source input to read
+ * @param name name of the input, for errors
+ * @param context the fieldSelection
+ * @return false if the input could not be read
+ */
+static bool fieldsInput(stream *source, const char *name, void *context) {
+    const fieldSelection *const selection = context;
+    size_t capacity = STREAM_BUFFER_SIZE;
+    char *buffer = malloc(capacity);
+    size_t used = 0;
+    ssize_t n;
+    while ((n = streamRead(source, buffer + used, capacity - used)) > 0 && !selection->out->failed) {
+        used += (size_t) n;
+        const char *line = buffer;
+        const char *newline;
+        while ((newline = memchr(line, '\n', (size_t) (buffer + used - line))) != NULL) {
+            printFields(selection, line, newline);
+            line = newline + 1;
+        }
+        // Keep the unfinished line, growing the buffer for lines longer than it
+        used -= (size_t) (line - buffer);
+        memmove(buffer, line, used);
+        if (used == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+        }
+    }
+    // A last line without a newline
+    if (used > 0 && n == 0) {
+        printFields(selection, buffer, buffer + used);
+    }
+    free(buffer);
+    if (n < 0) {
+        fprintf(stderr, "fields: %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Parse a field list such as 1,3-5,7-
+ * @param list list to parse
+ * @param selection populated with the ranges
+ * @return false if the list is invalid
+ */
+static bool parseFieldList(const char *list, fieldSelection *selection) {
+    selection->lastField = 0;
+    for (const char *p = list; *p != '\0';) {
+        char *end;
+        fieldRange range = {1, SIZE_MAX};
+        if (*p != '-') {
+            range.first = strtoul(p, &end, 10);
+            range.last = range.first;
+            if (end == p || range.first == 0) {
+                return false;
+            }
+            p = end;
+        }
+        if (*p == '-') {
+            ++p;
+            range.last = SIZE_MAX;
+            if (*p >= '0' && *p <= '9') {
+                range.last = strtoul(p, &end, 10);
+                p = end;
+            }
+            if (range.last < range.first) {
+                return false;
+            }
+        }
+        if (*p != ',' && *p != '\0') {
+            return false;
+        }
+        p += *p == ',';
+        selection->ranges = realloc(selection->ranges, sizeof(fieldRange) * (selection->rangeCount + 1));
+        selection->ranges[selection->rangeCount++] = range;
+        selection->lastField = range.last > selection->lastField ? range.last : selection->lastField;
+    }
+    return selection->rangeCount > 0;
+}
+
+/**
+ * Executes the fields command
+ * @param params -d delimiter for fields separated by one character rather than runs of spaces and tabs, then
+ * the field list, then files to read, - or none for the input
+ * @param in input of the command
+ * @param out output of the command
+ * @return exit status
+ */
+int fields(char *params[], stream *in, stream *out) {
+    fieldSelection selection = {.out = out};
+    if (*params != NULL && strncmp(*params, "-d", 2) == 0) {
+        const char *const delimiter = (*params)[2] != '\0' ? *params + 2 : *++params;
+        if (delimiter == NULL || strlen(delimiter) != 1) {
+            fprintf(stderr, "fields: the delimiter must be a single character\n");
+            return 2;
+        }
+        selection.delimiter = *delimiter;
+        ++params;
+    }
+    if (*params == NULL) {
+        fprintf(stderr, "fields: usage: fields [-d delimiter] list [file...]\n");
+        return 2;
+    }
+    if (!parseFieldList(*params, &selection)) {
+        fprintf(stderr, "fields: invalid field list %s\n", *params);
+        free(selection.ranges);
+        return 2;
+    }
+    const int status = streamEachInput("fields", params + 1, in, out, fieldsInput, &selection);
+    free(selection.ranges);
+    return status;
+}
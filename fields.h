@@ -0,0 +1,8 @@
+#ifndef ASSIGNMENT1_FIELDS_H
+#define ASSIGNMENT1_FIELDS_H
+
+#include "stream.h"
+
+int fields(char *params[], stream *in, stream *out);
+
+#endif
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "../tokenizer.h"
+
+/**
+ * libFuzzer harness for getcmd.
+ * Built with -DASSIGNMENT1_FUZZ=ON (clang) it links against libFuzzer, otherwise it replays the files given
+ * as arguments, e.g. every file in the fuzz/corpus directory
+ */
+
+/**
+ * Feed one input line to getcmd the same way the shell does and check the results are well formed
+ * @param data raw input, without the trailing newline
+ * @param size length of data
+ * @return 0, aborts if getcmd produced an invalid result
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    // The shell skips empty lines before tokenizing
+    if (size < 1) {
+        return 0;
+    }
+
+    char *const buffer = malloc(size + 1);
+    memcpy(buffer, data, size);
+    buffer[size] = '\0';
+
+    char *args[ARGS_SIZE + 1];
+    char *outputRedirection = NULL;
+    bool background = false;
+    int cmdPipeIndex = -1;
+    const int length = getcmd(buffer, (ssize_t) size - 1, args, &background, &outputRedirection, &cmdPipeIndex);
+
+    if (length != INT32_MAX) {
+        if (length < 0 || length > ARGS_SIZE || args[length] != NULL) {
+            abort();
+        }
+        if (cmdPipeIndex != -1 && (cmdPipeIndex < 1 || cmdPipeIndex > length)) {
+            abort();
+        }
+        for (int i = 0; i < length; ++i) {
+            if (args[i] != NULL && (args[i] < buffer || args[i] > buffer + size)) {
+                abort();
+            }
+        }
+    }
+
+    free(buffer);
+    return 0;
+}
+
+#ifndef ASSIGNMENT1_LIBFUZZER
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        FILE *const file = fopen(argv[i], "rb");
+        if (file == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        uint8_t data[1 << 16];
+        const size_t size = fread(data, 1, sizeof(data), file);
+        fclose(file);
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    printf("replayed %d inputs\n", argc - 1);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,61 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "input.h"
+#include "eventloop.h"
+
+/**
+ * Line reader for stdin, used instead of stdio so the shell knows when a line is already buffered
+ * and only runs the event loop when it would really block.
+ */
+
+#define INPUT_BUFFER_SIZE 4096
+
+static char inputBuffer[INPUT_BUFFER_SIZE];
+static size_t inputStart = 0;
+static size_t inputEnd = 0;
+
+/**
+ * Read a line from stdin, like getline
+ * @param line pointer to be populated with the allocated line, including its newline
+ * @return length of the line, -1 at the end of input
+ */
+ssize_t inputReadLine(char **line) {
+    *line = NULL;
+    size_t length = 0;
+    while (1) {
+        if (inputStart == inputEnd) {
+            const ssize_t n = eventLoopActive() ? eventLoopRead(STDIN_FILENO, inputBuffer, INPUT_BUFFER_SIZE)
+                                                : read(STDIN_FILENO, inputBuffer, INPUT_BUFFER_SIZE);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return length > 0 ? (ssize_t) length : -1;
+            }
+            inputStart = 0;
+            inputEnd = (size_t) n;
+        }
+
+        const char *const newline = memchr(inputBuffer + inputStart, '\n', inputEnd - inputStart);
+        const size_t chunk = newline != NULL ? (size_t) (newline - inputBuffer) + 1 - inputStart : inputEnd - inputStart;
+        *line = realloc(*line, length + chunk + 1);
+        memcpy(*line + length, inputBuffer + inputStart, chunk);
+        length += chunk;
+        (*line)[length] = '\0';
+        inputStart += chunk;
+        if (newline != NULL) {
+            return (ssize_t) length;
+        }
+    }
+}
+
+/**
+ * Wait for input without consuming it, running the event loop meanwhile
+ * @param timeout timeout in milliseconds
+ * @return true if input (or the end of input) is available before the timeout
+ */
+bool inputWaitFor(int timeout) {
+    return inputStart < inputEnd || eventLoopWaitReadableFor(STDIN_FILENO, timeout);
+}
@@ -0,0 +1,11 @@
+#ifndef ASSIGNMENT1_INPUT_H
+#define ASSIGNMENT1_INPUT_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+ssize_t inputReadLine(char **line);
+
+bool inputWaitFor(int timeout);
+
+#endif
@@ -0,0 +1,624 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "jobs.h"
+#include "stats.h"
+#include "spawn.h"
+
+/**
+ * Linked list of background jobs, in the order they were started.
+ * With job slots set, background jobs beyond the limit wait in the list as queued jobs.
+ * Free slots are shared between job classes by weight (stride scheduling), FIFO within a class.
+ * Queued jobs are also linked in a queue per class and running or stopped jobs in a live queue, with a count per
+ * state, so that adding, dispatching and reaping jobs does not walk the jobs that are done.
+ */
+
+#define STRIDE_SCALE (1 << 20)
+
+typedef struct jobQueue {
+    job *first;
+    job *last;
+} jobQueue;
+
+typedef struct jobClassInfo {
+    const char *name;
+    int weight;
+    int niceness;
+} jobClassInfo;
+
+static const jobClassInfo jobClasses[JOB_CLASS_COUNT] = {
+        {"interactive", 8, 0},
+        {"default",     4, 0},
+        {"batch",       1, 19},
+};
+
+// Stride scheduling state, the pass of each class and of the last dispatched job
+static uint64_t classPass[JOB_CLASS_COUNT];
+static uint64_t virtualTime = 0;
+
+// Queued jobs of every class and jobs that are running or stopped, oldest first
+static jobQueue classQueues[JOB_CLASS_COUNT];
+static jobQueue liveJobs;
+static int stateCounts[JOB_DONE + 1];
+
+node *head = NULL;
+static node *tail = NULL;
+int jobSlots = 0;
+
+/**
+ * Creates a job
+ * @param name name of the job
+ * @param pid pid of the child
+ * @return pointer to the created job
+ */
+job *createJob(char *const name, pid_t pid) {
+    job *const result = malloc(sizeof(job));
+    result->buffer = name;
+    result->name = name;
+    result->pid = pid;
+    result->pidfd = -1;
+    result->state = JOB_RUNNING;
+    result->jobClass = JOB_CLASS_DEFAULT;
+    result->started = statsNowNs();
+    result->ended = 0;
+    result->startTime = time(NULL);
+    result->status = 0;
+    result->audit = NULL;
+    result->sampler = (jobSampler) {-1, -1, 0, 0};
+    result->args = NULL;
+    result->outputRedirection = NULL;
+    result->cmdPipeIndex = -1;
+    result->coproc = NULL;
+    result->coprocFds[0] = -1;
+    result->coprocFds[1] = -1;
+    result->output = NULL;
+    result->reported = false;
+    result->prevInState = NULL;
+    result->nextInState = NULL;
+    return result;
+}
+
+/**
+ * Creates a node
+ * @param name name of the job
+ * @param pid pid of the child
+ * @return pointer to the created node
+ */
+node *createNode(char *const name, pid_t pid) {
+    node *const result = malloc(sizeof(node));
+    result->data = createJob(name, pid);
+    result->next = NULL;
+    return result;
+}
+
+/**
+ * @param j a job
+ * @return the queue a job in its state is linked in, NULL for jobs that are done
+ */
+static jobQueue *stateQueue(const job *j) {
+    switch (j->state) {
+        case JOB_QUEUED:
+            return &classQueues[j->jobClass];
+        case JOB_RUNNING:
+        case JOB_STOPPED:
+            return &liveJobs;
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * Count a job in its state and link it at the end of the state's queue
+ * @param j job to count
+ */
+static void enterState(job *j) {
+    ++stateCounts[j->state];
+    jobQueue *const queue = stateQueue(j);
+    if (queue == NULL) {
+        return;
+    }
+    j->prevInState = queue->last;
+    j->nextInState = NULL;
+    if (queue->last != NULL) {
+        queue->last->nextInState = j;
+    } else {
+        queue->first = j;
+    }
+    queue->last = j;
+}
+
+/**
+ * Stop counting a job in its state and unlink it from the state's queue
+ * @param j job to uncount
+ */
+static void leaveState(job *j) {
+    --stateCounts[j->state];
+    jobQueue *const queue = stateQueue(j);
+    if (queue == NULL) {
+        return;
+    }
+    if (j->prevInState != NULL) {
+        j->prevInState->nextInState = j->nextInState;
+    } else {
+        queue->first = j->nextInState;
+    }
+    if (j->nextInState != NULL) {
+        j->nextInState->prevInState = j->prevInState;
+    } else {
+        queue->last = j->prevInState;
+    }
+    j->prevInState = NULL;
+    j->nextInState = NULL;
+}
+
+/**
+ * Move a job to another state
+ * @param j job to move
+ * @param state new state of the job
+ */
+static void setJobState(job *j, jobState state) {
+    const bool live = j->state == JOB_RUNNING || j->state == JOB_STOPPED;
+    if (live && (state == JOB_RUNNING || state == JOB_STOPPED)) {
+        // Running and stopped jobs share the live queue, they keep their place in it
+        --stateCounts[j->state];
+        ++stateCounts[state];
+        j->state = state;
+        return;
+    }
+    leaveState(j);
+    j->state = state;
+    enterState(j);
+}
+
+/**
+ * Adds job to the linked list
+ * @param name name of the job
+ * @param pid pid of the child
+ * @return pointer to the added job
+ */
+job *addNode(char *const name, pid_t pid) {
+    node *const temp = createNode(name, pid);
+    if (head == NULL) {
+        head = temp;
+    } else {
+        tail->next = temp;
+    }
+    tail = temp;
+    enterState(temp->data);
+    return temp->data;
+}
+
+/**
+ * Finds the xth entry in the list
+ * @param x index of entry from the list to be found
+ * @return NULL if there is no such entry, otherwise the pointer to the node
+ */
+node *findNode(int x) {
+    node *cur = head;
+    for (int i = 1; i < x && cur != NULL; ++i) {
+        cur = cur->next;
+    }
+    return x < 1 ? NULL : cur;
+}
+
+/**
+ * Removes the xth entry from the list
+ * @param x index of entry from the list to be removed
+ * @return NULL if unsuccessful, otherwise the pointer to the removed node
+ */
+node *removeNode(int x) {
+    node *cur = head;
+    node *prev = NULL;
+    for (int i = 1; i < x && cur != NULL; ++i) {
+        prev = cur;
+        cur = cur->next;
+    }
+    if (cur == NULL) {
+        return NULL;
+    }
+
+    if (cur == head) {
+        head = cur->next;
+    } else {
+        prev->next = cur->next;
+    }
+    if (cur == tail) {
+        tail = prev;
+    }
+
+    return cur;
+}
+
+/**
+ * Close the /proc files of a job's sampler, if open
+ * @param sampler sampler to close
+ */
+void closeSampler(jobSampler *sampler) {
+    if (sampler->statFd >= 0) {
+        close(sampler->statFd);
+    }
+    if (sampler->statmFd >= 0) {
+        close(sampler->statmFd);
+    }
+    sampler->statFd = -1;
+    sampler->statmFd = -1;
+}
+
+/**
+ * Close a job's pidfd, if it has one
+ * @param j job to close the pidfd of
+ */
+void closePidfd(job *j) {
+    if (j->pidfd >= 0) {
+        close(j->pidfd);
+        j->pidfd = -1;
+    }
+}
+
+/**
+ * Send a signal to a job's process, through its pidfd if it has one so a reused pid cannot be hit
+ * @param j job to signal
+ * @param sig signal to send
+ * @return 0 on success, -1 on failure
+ */
+int signalJob(const job *j, int sig) {
+    if (j->pidfd >= 0) {
+        return (int) syscall(SYS_pidfd_send_signal, j->pidfd, sig, NULL, 0);
+    }
+    return kill(j->pid, sig);
+}
+
+/**
+ * Frees a node removed from the list, along with its job
+ * @param pNode node to be freed
+ */
+void freeNode(node *pNode) {
+    leaveState(pNode->data);
+    auditDiscard(pNode->data->audit);
+    closeSampler(&pNode->data->sampler);
+    closeCoproc(pNode->data);
+    closePidfd(pNode->data);
+    outputFree(pNode->data->output);
+    free(pNode->data->args);
+    free(pNode->data->buffer);
+    free(pNode->data);
+    free(pNode);
+}
+
+/**
+ * Removes a job from the list and frees it
+ * @param j job to be removed
+ */
+void removeJob(job *j) {
+    int index = 1;
+    for (node *cur = head; cur != NULL; cur = cur->next, ++index) {
+        if (cur->data == j) {
+            freeNode(removeNode(index));
+            return;
+        }
+    }
+}
+
+/**
+ * Close the shell's ends of a coprocess's pipes and remove its variables, if the job is a coprocess
+ * @param j job to close
+ */
+void closeCoproc(job *j) {
+    if (j->coproc == NULL) {
+        return;
+    }
+    const char *const suffixes[] = {"_0", "_1", "_PID"};
+    char variable[64];
+    for (int i = 0; i < 3; ++i) {
+        snprintf(variable, sizeof(variable), "%s%s", j->coproc, suffixes[i]);
+        unsetenv(variable);
+        if (i < 2 && j->coprocFds[i] >= 0) {
+            close(j->coprocFds[i]);
+            j->coprocFds[i] = -1;
+        }
+    }
+    free(j->coproc);
+    j->coproc = NULL;
+}
+
+/**
+ * @param text an argument of a command
+ * @param name a variable name or a path, e.g. calc_1 or /dev/fd/5
+ * @return true if the argument contains the name, not followed by more of a name or number
+ */
+static bool mentions(const char *text, const char *name) {
+    const size_t length = strlen(name);
+    for (const char *found = strstr(text, name); found != NULL; found = strstr(found + 1, name)) {
+        if (!isalnum((unsigned char) found[length]) && found[length] != '_') {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Find the coprocess fds a command uses, the ones it names as /dev/fd/N or through a coprocess's name_0 and name_1
+ * variables (e.g. in a script). The shell's ends are close-on-exec, only the commands using them get them.
+ * @param args command (tokenized)
+ * @param outputRedirection where the output is redirected, may be NULL
+ * @param fds array to be populated with the fds, may be NULL
+ * @param size size of the array
+ * @return amount of fds the command uses, only the first size of them are stored
+ */
+int coprocFdsUsed(char *args[], const char *outputRedirection, int fds[], int size) {
+    int count = 0;
+    // Coprocesses are closed once they are done, so only live jobs can be one
+    for (const job *cur = liveJobs.first; cur != NULL; cur = cur->nextInState) {
+        for (int i = 0; i < 2 && cur->coproc != NULL; ++i) {
+            if (cur->coprocFds[i] < 0) {
+                continue;
+            }
+            char path[32];
+            char variable[64];
+            snprintf(path, sizeof(path), "/dev/fd/%d", cur->coprocFds[i]);
+            snprintf(variable, sizeof(variable), "%s_%d", cur->coproc, i);
+            bool used = outputRedirection != NULL && mentions(outputRedirection, path);
+            for (char **arg = args; !used && *arg != NULL; ++arg) {
+                used = mentions(*arg, path) || mentions(*arg, variable);
+            }
+            if (used && count < size) {
+                fds[count] = cur->coprocFds[i];
+            }
+            count += used;
+        }
+    }
+    return count;
+}
+
+/**
+ * @param state state of a job
+ * @return name of the state, as shown by jobs
+ */
+const char *jobStateName(jobState state) {
+    switch (state) {
+        case JOB_QUEUED:
+            return "Queued";
+        case JOB_RUNNING:
+            return "Running";
+        case JOB_STOPPED:
+            return "Stopped";
+        default:
+            return "Done";
+    }
+}
+
+/**
+ * Find a job class by name
+ * @param name name of the class
+ * @param result pointer to be populated with the class
+ * @return true if there is such a class
+ */
+bool parseJobClass(const char *name, jobClass *result) {
+    for (int i = 0; i < JOB_CLASS_COUNT; ++i) {
+        if (strcmp(name, jobClasses[i].name) == 0) {
+            *result = (jobClass) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @param jobClass class of a job
+ * @return name of the class
+ */
+const char *jobClassName(jobClass jobClass) {
+    return jobClasses[jobClass].name;
+}
+
+/**
+ * @param jobClass class of a job
+ * @return nice increment that jobs of the class run with
+ */
+int jobClassNice(jobClass jobClass) {
+    return jobClasses[jobClass].niceness;
+}
+
+/**
+ * Update a job with a status returned by wait4
+ * @param j job to update
+ * @param status wait status of the job's process
+ * @param usage resource usage of the job's process
+ */
+void jobUpdate(job *j, int status, const struct rusage *usage) {
+    if (WIFSTOPPED(status)) {
+        setJobState(j, JOB_STOPPED);
+    } else if (WIFCONTINUED(status)) {
+        setJobState(j, JOB_RUNNING);
+    } else if (j->state != JOB_DONE) {
+        setJobState(j, JOB_DONE);
+        j->ended = statsNowNs();
+        j->status = status;
+        j->usage = *usage;
+        STAT_ADD(jobsReaped, 1);
+        auditFinish(j->audit, status, usage);
+        j->audit = NULL;
+        closeSampler(&j->sampler);
+        closeCoproc(j);
+        closePidfd(j);
+    }
+}
+
+/**
+ * Collect the state changes of every job without blocking
+ */
+void reapJobs(void) {
+    job *next;
+    for (job *cur = liveJobs.first; cur != NULL; cur = next) {
+        // A job that is done leaves the live queue
+        next = cur->nextInState;
+        int status = 0;
+        struct rusage usage;
+        if (wait4(cur->pid, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage) == cur->pid) {
+            jobUpdate(cur, status, &usage);
+        }
+    }
+    startQueuedJobs();
+}
+
+/**
+ * @return true if a new background job has to be queued rather than started
+ */
+bool jobsFull(void) {
+    // A job queued earlier must also start first
+    return jobSlots > 0 &&
+           (stateCounts[JOB_QUEUED] > 0 || stateCounts[JOB_RUNNING] + stateCounts[JOB_STOPPED] >= jobSlots);
+}
+
+/**
+ * Adds a job to the list without starting it
+ * @param name command as a string, the job takes ownership of it
+ * @param args command/s (tokenized), pointing into name, the job is named after the first one
+ * @param commandLength the amount of tokens in args
+ * @param outputRedirection where the output should be redirected, if NULL no redirection will take place
+ * @param cmdPipeIndex the next index after where the pipe was found, if -1 then no command piping will take place
+ * @param jobClass scheduling class of the job
+ * @return pointer to the queued job
+ */
+job *queueJob(char *name, char *args[], int commandLength, const char *outputRedirection, int cmdPipeIndex,
+              jobClass jobClass) {
+    job *const j = addNode(name, 0);
+    j->name = *args;
+    j->jobClass = jobClass;
+    setJobState(j, JOB_QUEUED);
+    j->args = malloc(sizeof(char *) * ((size_t) commandLength + 1));
+    memcpy(j->args, args, sizeof(char *) * ((size_t) commandLength + 1));
+    j->outputRedirection = outputRedirection;
+    j->cmdPipeIndex = cmdPipeIndex;
+    STAT_ADD(jobsQueued, 1);
+    return j;
+}
+
+/**
+ * Start a queued job
+ * @param j job to start
+ * @return true if the job is now running
+ */
+bool startJob(job *j) {
+    const pid_t pid = spawnCaptured(j->args, j->outputRedirection, j->cmdPipeIndex, jobClassNice(j->jobClass),
+                                    &j->pidfd, &j->output);
+    if (pid < 0) {
+        return false;
+    }
+    j->pid = pid;
+    setJobState(j, JOB_RUNNING);
+    j->started = statsNowNs();
+    j->startTime = time(NULL);
+    free(j->args);
+    j->args = NULL;
+    STAT_ADD(jobsLaunched, 1);
+    return true;
+}
+
+/**
+ * Pick the class whose queued job starts next, the one furthest behind its fair share
+ * @return the class, -1 if nothing is queued
+ */
+static int nextQueuedClass(void) {
+    int best = -1;
+    for (int i = 0; i < JOB_CLASS_COUNT; ++i) {
+        if (classQueues[i].first == NULL) {
+            continue;
+        }
+        // A class that was idle does not get to catch up on the slots it did not use
+        if (classPass[i] < virtualTime) {
+            classPass[i] = virtualTime;
+        }
+        if (best < 0 || classPass[i] < classPass[best]) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/**
+ * Charge a class its stride for a job of it that started
+ * @param jobClass class of the job
+ */
+static void chargeClass(int jobClass) {
+    virtualTime = classPass[jobClass];
+    classPass[jobClass] += STRIDE_SCALE / jobClasses[jobClass].weight;
+}
+
+/**
+ * Mark a queued job that could not be started as done, exited with 127 like a command that could not run
+ * @param j job to fail
+ */
+static void failJob(job *j) {
+    perror(j->name);
+    const struct rusage usage = {0};
+    jobUpdate(j, 127 << 8, &usage);
+    free(j->args);
+    j->args = NULL;
+}
+
+/**
+ * Start queued jobs while there are free job slots
+ */
+void startQueuedJobs(void) {
+    int active = stateCounts[JOB_RUNNING] + stateCounts[JOB_STOPPED];
+    int best;
+    while ((jobSlots <= 0 || active < jobSlots) && (best = nextQueuedClass()) >= 0) {
+        job *const next = classQueues[best].first;
+        // Only a job that started costs its class, one that failed leaves the queue so the others still run
+        if (!startJob(next)) {
+            failJob(next);
+            continue;
+        }
+        chargeClass(best);
+        ++active;
+    }
+}
+
+/**
+ * Report the jobs that are done since the last report, like the notifications other shells print at the prompt
+ * @param print whether to print them, as [n]\tDone\tname, or only mark them reported
+ */
+void reportDoneJobs(bool print) {
+    int index = 1;
+    for (node *cur = head; cur != NULL; cur = cur->next, ++index) {
+        job *const j = cur->data;
+        if (j->state == JOB_DONE && !j->reported) {
+            if (print) {
+                printf("[%d]\t%s\t%s\n", index, jobStateName(j->state), j->name);
+            }
+            j->reported = true;
+        }
+    }
+}
+
+/**
+ * Remove the jobs that are done once they have been reported, by jobs or at an earlier prompt, so the table does
+ * not keep every finished job. Jobs whose captured output has not been shown by fg are kept for jobs --output.
+ */
+void pruneReportedJobs(void) {
+    node *prev = NULL;
+    node *next;
+    for (node *cur = head; cur != NULL; cur = next) {
+        next = cur->next;
+        const jobOutput *const output = cur->data->output;
+        if (cur->data->state != JOB_DONE || !cur->data->reported || (output != NULL && output->tag == NULL)) {
+            prev = cur;
+            continue;
+        }
+        if (prev == NULL) {
+            head = next;
+        } else {
+            prev->next = next;
+        }
+        if (cur == tail) {
+            tail = prev;
+        }
+        freeNode(cur);
+    }
+}
@@ -0,0 +1,128 @@
+#ifndef ASSIGNMENT1_JOBS_H
+#define ASSIGNMENT1_JOBS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include "audit.h"
+#include "capture.h"
+
+typedef enum jobState {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE,
+} jobState;
+
+typedef enum jobClass {
+    JOB_CLASS_INTERACTIVE,
+    JOB_CLASS_DEFAULT,
+    JOB_CLASS_BATCH,
+    JOB_CLASS_COUNT,
+} jobClass;
+
+typedef struct jobSampler {
+    // /proc/<pid>/stat and statm, kept open between samples, -1 when not open
+    int statFd;
+    int statmFd;
+    unsigned long long lastTicks;
+    uint64_t lastSample;
+} jobSampler;
+
+typedef struct job {
+    // Command line buffer owned by the job, name points into it
+    char *buffer;
+    char *name;
+    pid_t pid;
+    // pidfd of the job's process, -1 if there is none
+    int pidfd;
+    jobState state;
+    jobClass jobClass;
+    // Monotonic start and end times, in nanoseconds, for elapsed times
+    uint64_t started;
+    uint64_t ended;
+    // Wall clock start time, for display
+    time_t startTime;
+    // Wait status and resource usage, once the job is done
+    int status;
+    struct rusage usage;
+    auditRecord *audit;
+    jobSampler sampler;
+    // Tokenized command of a queued job, pointing into name, NULL once it has started
+    char **args;
+    const char *outputRedirection;
+    int cmdPipeIndex;
+    // Name of a coprocess, NULL for other jobs, and the shell's ends of its pipes, -1 once closed
+    char *coproc;
+    int coprocFds[2];
+    // Captured stdout and stderr of the job, NULL if they go to the terminal
+    jobOutput *output;
+    // Whether the job has been reported done, by jobs or at a prompt, it is removed after that
+    bool reported;
+    // Neighbours in the queue of the job's class while it is queued, or among the live jobs while it runs
+    struct job *prevInState;
+    struct job *nextInState;
+} job;
+
+typedef struct node {
+    job *data;
+    struct node *next;
+} node;
+
+extern node *head;
+
+// Maximum amount of background jobs running at once, 0 for no limit
+extern int jobSlots;
+
+job *createJob(char *name, pid_t pid);
+
+node *createNode(char *name, pid_t pid);
+
+job *addNode(char *name, pid_t pid);
+
+node *findNode(int x);
+
+node *removeNode(int x);
+
+void closeSampler(jobSampler *sampler);
+
+void closePidfd(job *j);
+
+int signalJob(const job *j, int sig);
+
+void freeNode(node *pNode);
+
+void removeJob(job *j);
+
+void closeCoproc(job *j);
+
+int coprocFdsUsed(char *args[], const char *outputRedirection, int fds[], int size);
+
+const char *jobStateName(jobState state);
+
+bool parseJobClass(const char *name, jobClass *result);
+
+const char *jobClassName(jobClass jobClass);
+
+int jobClassNice(jobClass jobClass);
+
+void jobUpdate(job *j, int status, const struct rusage *usage);
+
+void reapJobs(void);
+
+bool jobsFull(void);
+
+job *queueJob(char *name, char *args[], int commandLength, const char *outputRedirection, int cmdPipeIndex,
+              jobClass jobClass);
+
+bool startJob(job *j);
+
+void startQueuedJobs(void);
+
+void reportDoneJobs(bool print);
+
+void pruneReportedJobs(void);
+
+#endif
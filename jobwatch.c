@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/fcntl.h>
+#include "jobwatch.h"
+#include "jobs.h"
+#include "input.h"
+#include "stats.h"
+
+/**
+ * jobs --watch, a refreshing table of cpu and memory use of every job.
+ * Each job's /proc/<pid>/stat and statm stay open between samples and are re-read with pread.
+ */
+
+#define PROC_READ_SIZE 512
+
+typedef struct jobSample {
+    double cpuPercent;
+    unsigned long long residentBytes;
+    unsigned long long virtualBytes;
+} jobSample;
+
+/**
+ * Open a /proc file of a process
+ * @param pid process to inspect
+ * @param name name of the file in the process's /proc directory
+ * @return the fd, -1 if the process is gone
+ */
+static int openProcFile(pid_t pid, const char *name) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", (int) pid, name);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/**
+ * Read a /proc file from its start
+ * @param fd fd of the file
+ * @param buffer buffer of PROC_READ_SIZE bytes to be populated, NUL terminated
+ * @return true if anything was read
+ */
+static bool readProcFile(int fd, char *buffer) {
+    const ssize_t n = pread(fd, buffer, PROC_READ_SIZE - 1, 0);
+    if (n <= 0) {
+        return false;
+    }
+    buffer[n] = '\0';
+    return true;
+}
+
+/**
+ * Sample a job's cpu and memory use
+ * @param j job to sample
+ * @param sample pointer to be populated
+ * @return true if the job's process could be sampled
+ */
+static bool sampleJob(job *const j, jobSample *const sample) {
+    jobSampler *const sampler = &j->sampler;
+    if (sampler->statFd < 0) {
+        sampler->statFd = openProcFile(j->pid, "stat");
+        sampler->statmFd = openProcFile(j->pid, "statm");
+        sampler->lastTicks = 0;
+        sampler->lastSample = j->started;
+    }
+
+    char buffer[PROC_READ_SIZE];
+    unsigned long long utime;
+    unsigned long long stime;
+    unsigned long long size;
+    unsigned long long resident;
+    // The command name can contain spaces, so fields are counted from its closing bracket
+    const char *fields = readProcFile(sampler->statFd, buffer) ? strrchr(buffer, ')') : NULL;
+    if (fields == NULL ||
+        sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+        closeSampler(sampler);
+        return false;
+    }
+    if (!readProcFile(sampler->statmFd, buffer) || sscanf(buffer, "%llu %llu", &size, &resident) != 2) {
+        closeSampler(sampler);
+        return false;
+    }
+
+    const uint64_t now = statsNowNs();
+    const unsigned long long ticks = utime + stime;
+    const double seconds = (double) (now - sampler->lastSample) / 1e9;
+    sample->cpuPercent = seconds > 0 ? 100.0 * (double) (ticks - sampler->lastTicks) /
+                                       (double) sysconf(_SC_CLK_TCK) / seconds : 0;
+    sample->residentBytes = resident * (unsigned long long) sysconf(_SC_PAGESIZE);
+    sample->virtualBytes = size * (unsigned long long) sysconf(_SC_PAGESIZE);
+    sampler->lastTicks = ticks;
+    sampler->lastSample = now;
+    return true;
+}
+
+/**
+ * Format a byte count with a binary unit
+ * @param buffer buffer to be populated
+ * @param size size of the buffer
+ * @param bytes byte count
+ * @return buffer
+ */
+static char *formatBytes(char *buffer, size_t size, unsigned long long bytes) {
+    static const char units[] = "BKMGT";
+    double value = (double) bytes;
+    int unit = 0;
+    while (value >= 1024 && unit < 4) {
+        value /= 1024;
+        ++unit;
+    }
+    snprintf(buffer, size, unit == 0 ? "%.0f%c" : "%.1f%c", value, units[unit]);
+    return buffer;
+}
+
+/**
+ * Print one frame of the table
+ * @param interval seconds between samples
+ * @return amount of jobs still running or stopped
+ */
+static int renderJobs(double interval) {
+    reapJobs();
+    const uint64_t now = statsNowNs();
+    // Move to the top left and clear the screen
+    printf("\033[H\033[2J");
+    printf("Every %.1fs, press Enter to stop\n\n", interval);
+    printf("%-6s%-8s%-9s%7s%9s%9s%10s  %s\n", "JOB", "PID", "STATE", "%CPU", "RSS", "VSZ", "ELAPSED", "COMMAND");
+
+    int live = 0;
+    int index = 1;
+    for (node *cur = head; cur != NULL; cur = cur->next, ++index) {
+        job *const j = cur->data;
+        jobSample sample;
+        char rss[16] = "-";
+        char vsz[16] = "-";
+        char cpu[16] = "-";
+        if ((j->state == JOB_RUNNING || j->state == JOB_STOPPED) && sampleJob(j, &sample)) {
+            formatBytes(rss, sizeof(rss), sample.residentBytes);
+            formatBytes(vsz, sizeof(vsz), sample.virtualBytes);
+            snprintf(cpu, sizeof(cpu), "%.1f", sample.cpuPercent);
+        }
+        live += j->state != JOB_DONE;
+        char label[16];
+        snprintf(label, sizeof(label), "[%d]", index);
+        const double elapsed = (double) ((j->state == JOB_DONE ? j->ended : now) - j->started) / 1e9;
+        printf("%-6s%-8d%-9s%7s%9s%9s%9.1fs  %s\n", label, (int) j->pid, jobStateName(j->state), cpu, rss, vsz,
+               elapsed, j->name);
+    }
+    fflush(stdout);
+    return live;
+}
+
+/**
+ * Refresh the table until every job is done or input arrives, the input is left for the prompt
+ * @param interval seconds between samples
+ */
+void jobsWatch(double interval) {
+    while (renderJobs(interval) > 0 && !inputWaitFor((int) (interval * 1000)));
+}
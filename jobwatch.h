@@ -0,0 +1,6 @@
+#ifndef ASSIGNMENT1_JOBWATCH_H
+#define ASSIGNMENT1_JOBWATCH_H
+
+void jobsWatch(double interval);
+
+#endif
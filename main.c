@@ -6,111 +6,184 @@
 #include <unistd.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <stdint.h>
 #include <sys/fcntl.h>
+#include "tokenizer.h"
+#include "trace.h"
+#include "stats.h"
+#include "jobs.h"
+#include "eventloop.h"
+#include "input.h"
+#include "metrics.h"
+#include "audit.h"
+#include "jobwatch.h"
+#include "spawn.h"
+#include "dag.h"
+#include "workerpool.h"
+#include "zygote.h"
+#include "stream.h"
+#include "capture.h"
+#include "optimize.h"
 
 /**
  * When using command piping and input redirection make sure to use spaces.
  * The echo command will ignore spaces, i.e. echo "hi  hello" will output "hi hello".
  */
 
-#define ARGS_SIZE 30
-
-typedef struct job {
-    char *name;
-    pid_t pid;
-} job;
-
-typedef struct node {
-    job *data;
-    struct node *next;
-} node;
-
-node *head = NULL;
-
 /**
- * Creates a job
- * @param name name of the job
+ * Wait for a child, keeping track of the time spent waiting
  * @param pid pid of the child
- * @return pointer to the created job
+ * @param status pointer to be populated with the status of the child
+ * @param usage pointer to be populated with the resource usage of the child
+ * @return result of wait4
  */
-job *createJob(char *const name, pid_t pid) {
-    job *const result = malloc(sizeof(job));
-    result->name = name;
-    result->pid = pid;
+pid_t waitChild(pid_t pid, int *status, struct rusage *usage) {
+    const uint64_t start = statsNowNs();
+    // Keep serving the event loop while a foreground child runs, if anything is watched or jobs may be queued
+    const pid_t result = eventLoopActive() || jobSlots > 0 ? eventLoopWaitChild(pid, status, WUNTRACED, usage)
+                                           : wait4(pid, status, WUNTRACED, usage);
+    STAT_ADD(waitNs, statsNowNs() - start);
+    // runCmd exits with 127 when the command could not be executed
+    if (result == pid && WIFEXITED(*status) && WEXITSTATUS(*status) == 127) {
+        STAT_ADD(execFailures, 1);
+    }
     return result;
 }
 
 /**
- * Creates a node
- * @param name name of the job
- * @param pid pid of the child
- * @return pointer to the created node
+ * Print a string as a JSON string
+ * @param value string to print
+ * @return amount of bytes printed
  */
-node *createNode(char *const name, pid_t pid) {
-    node *const result = malloc(sizeof(node));
-    result->data = createJob(name, pid);
-    result->next = NULL;
-    return result;
+static int printJsonString(const char *value) {
+    int bytes = 0;
+    bytes += printf("\"");
+    for (; *value != '\0'; ++value) {
+        if (*value == '"' || *value == '\\') {
+            bytes += printf("\\%c", *value);
+        } else if ((unsigned char) *value < 0x20) {
+            bytes += printf("\\u%04x", (unsigned char) *value);
+        } else {
+            bytes += printf("%c", *value);
+        }
+    }
+    bytes += printf("\"");
+    return bytes;
 }
 
 /**
- * Adds job to the linked list
- * @param name name of the job
- * @param pid pid of the child
+ * Print one job in the jobs -l long format
+ * @param index index of the job
+ * @param j job to print
+ * @param now current monotonic time, in nanoseconds
+ * @return amount of bytes printed
  */
-void addNode(char *const name, pid_t pid) {
-    node *const temp = createNode(name, pid);
-    if (head == NULL) {
-        head = temp;
-    } else {
-        node *cur = head;
-        while (cur->next != NULL) {
-            cur = cur->next;
-        }
-        cur->next = temp;
+static int printJobLong(int index, const job *const j, uint64_t now) {
+    char started[32];
+    strftime(started, sizeof(started), "%Y-%m-%d %H:%M:%S", localtime(&j->startTime));
+    const double elapsed = (double) ((j->state == JOB_DONE ? j->ended : now) - j->started) / 1e9;
+    int bytes = printf("[%d]\t%d\t%-8s%-12s%s  %9.2fs", index, (int) j->pid, jobStateName(j->state),
+                       jobClassName(j->jobClass), started, elapsed);
+    if (j->state == JOB_DONE) {
+        bytes += printf("  cpu %.2fs  maxrss %ldKB",
+                        (double) j->usage.ru_utime.tv_sec + (double) j->usage.ru_utime.tv_usec / 1e6 +
+                        (double) j->usage.ru_stime.tv_sec + (double) j->usage.ru_stime.tv_usec / 1e6,
+                        j->usage.ru_maxrss);
     }
+    bytes += printf("\t%s\n", j->name);
+    return bytes;
 }
 
 /**
- * Removes the xth entry from the list
- * @param x index of entry from the list to be removed
- * @return NULL if unsuccessful, otherwise the pointer to the removed node
+ * Print one job as a JSON object
+ * @param index index of the job
+ * @param j job to print
+ * @param now current monotonic time, in nanoseconds
+ * @return amount of bytes printed
  */
-node *removeNode(int x) {
-    node *cur = head;
-    node *prev = NULL;
-    for (int i = 1; i < x && cur != NULL; ++i) {
-        prev = cur;
-        cur = cur->next;
-    }
-    if (cur == NULL) {
-        return NULL;
+static int printJobJson(int index, const job *const j, uint64_t now) {
+    const double elapsed = (double) ((j->state == JOB_DONE ? j->ended : now) - j->started) / 1e9;
+    int bytes = printf("{\"index\":%d,\"pid\":%d,\"state\":\"%s\",\"class\":\"%s\",\"command\":", index,
+                       (int) j->pid, jobStateName(j->state), jobClassName(j->jobClass));
+    bytes += printJsonString(j->name);
+    bytes += printf(",\"start\":%lld,\"elapsed\":%.3f", (long long) j->startTime, elapsed);
+    if (j->state == JOB_DONE) {
+        bytes += printf(",\"status\":%d,\"utime\":%ld.%06ld,\"stime\":%ld.%06ld,\"maxrss_kb\":%ld",
+                        WIFSIGNALED(j->status) ? 128 + WTERMSIG(j->status) : WEXITSTATUS(j->status),
+                        (long) j->usage.ru_utime.tv_sec, (long) j->usage.ru_utime.tv_usec,
+                        (long) j->usage.ru_stime.tv_sec, (long) j->usage.ru_stime.tv_usec, j->usage.ru_maxrss);
     }
+    bytes += printf("}");
+    return bytes;
+}
 
-    if (cur == head) {
-        head = cur->next;
+/**
+ * Print the captured output of a job, for jobs --output
+ * @param params the job, as %n or n
+ */
+static void jobsOutput(char *params[]) {
+    if (*params == NULL || params[1] != NULL) {
+        fprintf(stderr, "jobs: usage: jobs --output %%n\n");
+        return;
+    }
+    const int index = (int) strtol(*params + (**params == '%'), NULL, 10);
+    node *const pNode = index > 0 ? findNode(index) : NULL;
+    if (pNode == NULL) {
+        fprintf(stderr, "jobs: no such job %s\n", *params);
+    } else if (pNode->data->output == NULL) {
+        fprintf(stderr, "jobs: output of job [%d] is not captured\n", index);
     } else {
-        prev->next = cur->next;
+        outputReplay(pNode->data->output);
     }
-
-    return cur;
 }
 
 /**
  * Executes the jobs command
- * @param params parameters for command (should be empty)
+ * @param params parameters for command, -l for the long format, --json, --watch [interval] or --output %n
  */
 void jobs(char *params[]) {
-    if (*params != NULL) {
-        fprintf(stderr, "jobs: too many arguments\n");
+    if (*params != NULL && strcmp(*params, "--output") == 0) {
+        jobsOutput(params + 1);
+        return;
+    }
+    if (*params != NULL && strcmp(*params, "--watch") == 0) {
+        const double interval = params[1] != NULL ? strtod(params[1], NULL) : 1;
+        if (interval <= 0 || (params[1] != NULL && params[2] != NULL)) {
+            fprintf(stderr, "jobs: usage: jobs --watch [interval]\n");
+        } else {
+            jobsWatch(interval);
+        }
+        return;
+    }
+
+    const bool longFormat = *params != NULL && strcmp(*params, "-l") == 0;
+    const bool json = *params != NULL && strcmp(*params, "--json") == 0;
+    if (*params != NULL && (!(longFormat || json) || params[1] != NULL)) {
+        fprintf(stderr, "jobs: usage: jobs [-l|--json|--watch [interval]|--output %%n]\n");
         return;
     }
 
+    reapJobs();
+    const uint64_t now = statsNowNs();
+    int bytes = json ? printf("[") : 0;
     int index = 1;
     for (node *cur = head; cur != NULL; cur = cur->next, ++index) {
-        printf("[%d]\t%s\n", index, cur->data->name);
+        if (longFormat) {
+            bytes += printJobLong(index, cur->data, now);
+        } else if (json) {
+            bytes += printf(index > 1 ? "," : "");
+            bytes += printJobJson(index, cur->data, now);
+        } else {
+            bytes += printf("[%d]\t%s\t%s\n", index, jobStateName(cur->data->state), cur->data->name);
+        }
+        cur->data->reported |= cur->data->state == JOB_DONE;
     }
+    if (json) {
+        bytes += printf("]\n");
+    }
+    STAT_ADD(builtinBytes, bytes);
+    pruneReportedJobs();
 }
 
 /**
@@ -132,18 +205,43 @@ void fg(char *params[]) {
         return;
     }
 
-    node *const pNode = removeNode(index);
+    node *const pNode = findNode(index);
     if (pNode == NULL) {
         fprintf(stderr, "fg given invalid index [%d]\n", index);
         return;
     }
 
-    int status = 0;
-    waitpid(pNode->data->pid, &status, WUNTRACED);
+    job *const j = pNode->data;
+    if (j->state == JOB_QUEUED && !startJob(j)) {
+        perror("fg");
+        return;
+    }
+    // Captured output is shown first, then followed while the job is in the foreground, tagged output is live anyway
+    const bool captured = j->output != NULL && j->output->tag == NULL;
+    if (captured) {
+        outputReplay(j->output);
+        outputFollow(j->output, true);
+    }
+    if (j->state != JOB_DONE) {
+        if (j->state == JOB_STOPPED) {
+            signalJob(j, SIGCONT);
+        }
+        int status = 0;
+        struct rusage usage;
+        const uint64_t waitStart = traceNow();
+        if (waitChild(j->pid, &status, &usage) == j->pid) {
+            jobUpdate(j, status, &usage);
+        }
+        traceRecord(TRACE_WAIT, waitStart, 0, j->name);
+    }
 
-    free(pNode->data->name);
-    free(pNode->data);
-    free(pNode);
+    if (captured) {
+        outputFollow(j->output, false);
+    }
+    // A job that stopped again stays in the table
+    if (j->state != JOB_STOPPED) {
+        freeNode(removeNode(index));
+    }
 }
 
 /**
@@ -151,10 +249,12 @@ void fg(char *params[]) {
  * @param params parameters for command
  */
 void echo(char *params[]) {
+    int bytes = 0;
     while (params[1] != NULL) {
-        printf("%s ", *params++);
+        bytes += printf("%s ", *params++);
     }
-    puts(*params);
+    bytes += printf("%s\n", *params);
+    STAT_ADD(builtinBytes, bytes);
 }
 
 /**
@@ -165,6 +265,7 @@ void pwd(char *params[]) {
     if (*params == NULL) {
         char *const cwd = getcwd(NULL, 0);
         puts(cwd);
+        STAT_ADD(builtinBytes, strlen(cwd) + 1);
         free(cwd);
     } else {
         fprintf(stderr, "pwd: too many arguments\n");
@@ -189,13 +290,362 @@ void cd(char *params[]) {
     }
 }
 
+/**
+ * Executes the stats command, prints the shell's counters
+ * @param params parameters for command (should be empty)
+ */
+void printStats(char *params[]) {
+    if (*params != NULL) {
+        fprintf(stderr, "stats: too many arguments\n");
+        return;
+    }
+    STAT_ADD(builtinBytes, statsPrint(stdout));
+}
+
+#define DEFAULT_TRACE_FILE "assignment1-trace.json"
+
+// Where the counters are dumped when the shell exits, "-" for stderr, NULL to not dump them
+char *statsDumpPath = NULL;
+
 /**
  * Kill all processes
  */
 void exitShell() {
+    if (statsDumpPath != NULL) {
+        FILE *const out = strcmp(statsDumpPath, "-") == 0 ? stderr : fopen(statsDumpPath, "w");
+        if (out == NULL) {
+            perror("stats-dump");
+        } else {
+            statsPrint(out);
+            if (out != stderr) {
+                fclose(out);
+            }
+        }
+    }
+    traceClose();
+    metricsClose();
+    auditClose();
     kill(0, SIGTERM);
 }
 
+typedef struct shellOption {
+    const char *name;
+    bool (*apply)(bool enable, const char *value);
+    const char *(*show)(void);
+} shellOption;
+
+/**
+ * Turns per-phase trace timing on or off
+ * @param enable true for set -o, false for set +o
+ * @param value file to write the trace to, NULL for the default file
+ * @return true if the option was applied
+ */
+static bool applyTraceTiming(bool enable, const char *value) {
+    if (!enable) {
+        traceClose();
+    } else if (!traceOpen(value != NULL ? value : DEFAULT_TRACE_FILE)) {
+        perror("set: trace-timing");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @return current state of the trace-timing option
+ */
+static const char *showTraceTiming(void) {
+    return traceEnabled() ? "on" : "off";
+}
+
+/**
+ * Turns dumping the counters at exit on or off
+ * @param enable true for set -o, false for set +o
+ * @param value file to dump the counters to, NULL for stderr
+ * @return true if the option was applied
+ */
+static bool applyStatsDump(bool enable, const char *value) {
+    free(statsDumpPath);
+    statsDumpPath = enable ? strdup(value != NULL ? value : "-") : NULL;
+    return true;
+}
+
+/**
+ * @return current state of the stats-dump option
+ */
+static const char *showStatsDump(void) {
+    if (statsDumpPath == NULL) {
+        return "off";
+    }
+    return strcmp(statsDumpPath, "-") == 0 ? "on" : statsDumpPath;
+}
+
+/**
+ * Starts or stops serving metrics on a Unix socket
+ * @param enable true for set -o, false for set +o
+ * @param value path of the socket, required when enabling
+ * @return true if the option was applied
+ */
+static bool applyMetricsSocket(bool enable, const char *value) {
+    if (!enable) {
+        metricsClose();
+        return true;
+    }
+    if (value == NULL) {
+        fprintf(stderr, "set: metrics-socket requires a path\n");
+        return false;
+    }
+    return metricsOpen(value);
+}
+
+/**
+ * @return current state of the metrics-socket option
+ */
+static const char *showMetricsSocket(void) {
+    return metricsPath() != NULL ? metricsPath() : "off";
+}
+
+/**
+ * Turns the audit log on or off
+ * @param enable true for set -o, false for set +o
+ * @param value file to append records to, required when enabling
+ * @return true if the option was applied
+ */
+static bool applyAuditLog(bool enable, const char *value) {
+    if (!enable) {
+        auditClose();
+        return true;
+    }
+    if (value == NULL) {
+        fprintf(stderr, "set: audit-log requires a path\n");
+        return false;
+    }
+    if (!auditOpen(value)) {
+        perror("set: audit-log");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @return current state of the audit-log option
+ */
+static const char *showAuditLog(void) {
+    return auditPath() != NULL ? auditPath() : "off";
+}
+
+/**
+ * Sets the maximum amount of background jobs running at once, further jobs are queued
+ * @param enable true for set -o, false for set +o to remove the limit
+ * @param value maximum amount of running jobs, required when enabling
+ * @return true if the option was applied
+ */
+static bool applyJobSlots(bool enable, const char *value) {
+    const int slots = enable && value != NULL ? (int) strtol(value, NULL, 10) : 0;
+    if (enable && slots < 1) {
+        fprintf(stderr, "set: jobslots requires a positive number\n");
+        return false;
+    }
+    jobSlots = slots;
+    startQueuedJobs();
+    return true;
+}
+
+/**
+ * @return current state of the jobslots option
+ */
+static const char *showJobSlots(void) {
+    static char slots[16];
+    if (jobSlots <= 0) {
+        return "off";
+    }
+    snprintf(slots, sizeof(slots), "%d", jobSlots);
+    return slots;
+}
+
+/**
+ * Sets the size of the prefork worker pool
+ * @param enable true for set -o, false for set +o to stop the workers
+ * @param value amount of idle workers to keep, required when enabling
+ * @return true if the option was applied
+ */
+static bool applyWorkers(bool enable, const char *value) {
+    const int size = enable && value != NULL ? (int) strtol(value, NULL, 10) : 0;
+    if (enable && size < 1) {
+        fprintf(stderr, "set: workers requires a positive number\n");
+        return false;
+    }
+    if (!workerPoolResize(size)) {
+        perror("set: workers");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @return current state of the workers option
+ */
+static const char *showWorkers(void) {
+    static char size[16];
+    if (workerPoolSize() <= 0) {
+        return "off";
+    }
+    snprintf(size, sizeof(size), "%d", workerPoolSize());
+    return size;
+}
+
+/**
+ * Starts or stops the zygote that spawns commands for the shell
+ * @param enable true for set -o, false for set +o
+ * @param value unused
+ * @return true if the option was applied
+ */
+static bool applyZygote(bool enable, const char *value) {
+    (void) value;
+    if (!enable) {
+        zygoteClose();
+        return true;
+    }
+    if (!zygoteOpen()) {
+        perror("set: zygote");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @return current state of the zygote option
+ */
+static const char *showZygote(void) {
+    return zygoteActive() ? "on" : "off";
+}
+
+/**
+ * Turns capturing the output of background jobs on or off, for jobs started from now on
+ * @param enable true for set -o, false for set +o
+ * @param value unused
+ * @return true if the option was applied
+ */
+static bool applyCaptureOutput(bool enable, const char *value) {
+    (void) value;
+    captureOutput = enable;
+    return true;
+}
+
+/**
+ * @return current state of the capture-output option
+ */
+static const char *showCaptureOutput(void) {
+    return captureOutput ? "on" : "off";
+}
+
+/**
+ * Turns tagging the output lines of background jobs on or off, for jobs started from now on
+ * @param enable true for set -o, false for set +o
+ * @param value ordered to print the lines of each job only once the jobs started before it have finished, may be NULL
+ * @return true if the option was applied
+ */
+static bool applyTagOutput(bool enable, const char *value) {
+    if (enable && value != NULL && strcmp(value, "ordered") != 0) {
+        fprintf(stderr, "set: tag-output only accepts ordered\n");
+        return false;
+    }
+    tagOutput = !enable ? TAG_OFF : value != NULL ? TAG_ORDERED : TAG_ON;
+    return true;
+}
+
+/**
+ * @return current state of the tag-output option
+ */
+static const char *showTagOutput(void) {
+    return tagOutput == TAG_OFF ? "off" : tagOutput == TAG_ON ? "on" : "ordered";
+}
+
+/**
+ * Turns splitting commands too long for execve into batches on or off
+ * @param enable true for set -o, false for set +o
+ * @param value parallel to run the batches at once, at most one per cpu, may be NULL to run them in turn
+ * @return true if the option was applied
+ */
+static bool applySplitArgs(bool enable, const char *value) {
+    if (enable && value != NULL && strcmp(value, "parallel") != 0) {
+        fprintf(stderr, "set: split-args only accepts parallel\n");
+        return false;
+    }
+    splitArgs = !enable ? SPLIT_OFF : value != NULL ? SPLIT_PARALLEL : SPLIT_SEQUENTIAL;
+    return true;
+}
+
+/**
+ * @return current state of the split-args option
+ */
+static const char *showSplitArgs(void) {
+    return splitArgs == SPLIT_OFF ? "off" : splitArgs == SPLIT_SEQUENTIAL ? "on" : "parallel";
+}
+
+/**
+ * Turns printing the plan of every command on or off
+ * @param enable true for set -o, false for set +o
+ * @param value unused
+ * @return true if the option was applied
+ */
+static bool applyExplain(bool enable, const char *value) {
+    (void) value;
+    explainPlans = enable;
+    return true;
+}
+
+/**
+ * @return current state of the explain option
+ */
+static const char *showExplain(void) {
+    return explainPlans ? "on" : "off";
+}
+
+static const shellOption shellOptions[] = {
+        {"trace-timing",   applyTraceTiming,   showTraceTiming},
+        {"stats-dump",     applyStatsDump,     showStatsDump},
+        {"metrics-socket", applyMetricsSocket, showMetricsSocket},
+        {"audit-log",      applyAuditLog,      showAuditLog},
+        {"jobslots",       applyJobSlots,      showJobSlots},
+        {"workers",        applyWorkers,       showWorkers},
+        {"zygote",         applyZygote,        showZygote},
+        {"capture-output", applyCaptureOutput, showCaptureOutput},
+        {"tag-output",     applyTagOutput,     showTagOutput},
+        {"split-args",     applySplitArgs,     showSplitArgs},
+        {"explain",        applyExplain,       showExplain},
+};
+
+/**
+ * Executes the set command, set -o name[=value] turns an option on, set +o name turns it off
+ * @param params parameters for command, empty to list the options
+ */
+void set(char *params[]) {
+    const size_t optionCount = sizeof(shellOptions) / sizeof(*shellOptions);
+    if (*params == NULL) {
+        for (size_t i = 0; i < optionCount; ++i) {
+            STAT_ADD(builtinBytes, printf("%-16s%s\n", shellOptions[i].name, shellOptions[i].show()));
+        }
+        return;
+    }
+    if (params[1] == NULL || params[2] != NULL || (strcmp(*params, "-o") != 0 && strcmp(*params, "+o") != 0)) {
+        fprintf(stderr, "set: usage: set [-o|+o] option[=value]\n");
+        return;
+    }
+
+    const bool enable = **params == '-';
+    char *const value = strchr(params[1], '=');
+    if (value != NULL) {
+        *value = '\0';
+    }
+    for (size_t i = 0; i < optionCount; ++i) {
+        if (strcmp(params[1], shellOptions[i].name) == 0) {
+            shellOptions[i].apply(enable, value != NULL ? value + 1 : NULL);
+            return;
+        }
+    }
+    fprintf(stderr, "set: unknown option '%s'\n", params[1]);
+}
+
 /**
  * Executes a cmd if it matches the description of a built in cmd
  * @param cmd command to match against and execute
@@ -215,76 +665,18 @@ bool runBuiltIn(char *cmd, char *params[]) {
         exitShell();
     } else if (strcmp(cmd, "echo") == 0) {
         echo(params);
+    } else if (strcmp(cmd, "set") == 0) {
+        set(params);
+    } else if (strcmp(cmd, "stats") == 0) {
+        printStats(params);
+    } else if (strcmp(cmd, "dag") == 0) {
+        runDagCommand(params);
     } else {
         return false;
     }
     return true;
 }
 
-/**
- * Tokenize a string so that it can easily be read for commands
- * @param buffer string to be tokenized
- * @param bufferEnd last index of the buffer string
- * @param args array of string tokens to be populated
- * @param background pointer to bool to be populated, true if the command should be run in the background
- * @param outputRedirection pointer to string to be populated, NULL if no output redirection will take place
- * @param cmdPipeIndex pointer to int to be populated, will equal -1 if no command piping is to take place
- * @return the amount of tokens populated into args
- */
-int
-getcmd(char *buffer, ssize_t bufferEnd, char *args[], bool *background, char **outputRedirection, int *cmdPipeIndex) {
-    *cmdPipeIndex = -1;
-    *outputRedirection = NULL;
-    *background = false;
-    int i = 0;
-    char *token;
-
-    bool exit = false;
-    // Check if background is specified
-    while (!exit && bufferEnd >= 0 && (buffer[bufferEnd] == '&' || isspace(buffer[bufferEnd]))) {
-        if (buffer[bufferEnd] == '&') {
-            *background = true;
-            buffer[bufferEnd] = ' ';
-            exit = true;
-        }
-        bufferEnd--;
-    }
-    // Skip tokenizing if string is empty
-    if (bufferEnd < 0) {
-        return 0;
-    }
-
-    while ((token = strsep(&buffer, " \t")) != NULL) {
-        if (strlen(token) > 0) {
-            if (i > ARGS_SIZE) {
-                return INT32_MAX;
-            }
-            if (strcmp(token, ">") == 0) {
-                char *temp = buffer;
-                if ((token = strsep(&temp, " \t")) != NULL) {
-                    *outputRedirection = token;
-                    strsep(&buffer, " \t"); // To skip this instance
-                } else {
-                    fprintf(stderr, "Error parsing '>'");
-                }
-            } else if (strcmp(token, "|") == 0) {
-                if (i == 0 ||
-                    *cmdPipeIndex > 0) { // If it's the first token or there's already been a pipe, then error out
-                    fprintf(stderr, "Error parsing '|'");
-                } else {
-                    args[i++] = NULL;
-                    *cmdPipeIndex = i;
-                }
-            } else {
-                args[i++] = token;
-            }
-        }
-    }
-    args[i] = NULL;
-
-    return i;
-}
-
 /**
  * Safely read a line from stdin
  * @param bufferLength pointer to be updated as the length variable of the read string
@@ -292,8 +684,7 @@ getcmd(char *buffer, ssize_t bufferEnd, char *args[], bool *background, char **o
  */
 static char *getLine(ssize_t *const bufferLength) {
     char *buffer = NULL;
-    size_t size = 0;
-    *bufferLength = getline(&buffer, &size, stdin);
+    *bufferLength = inputReadLine(&buffer);
     if (*bufferLength < 2) {
         free(buffer);
         // Exit if CTRL+D was pressed
@@ -308,30 +699,96 @@ static char *getLine(ssize_t *const bufferLength) {
 }
 
 /**
- * Run the given command
- * @param args command
- * @param outputRedirection where the output should be redirected, if NULL no redirection will take place
+ * Parse the bg prefix, bg [-c class] command runs command in the background in a job class
+ * @param args command/s (tokenized), starting with bg
+ * @param commandLength the amount of tokens in args
+ * @param cmdPipeIndex the next index after where the pipe was found, -1 if there is no pipe
+ * @param jobClass pointer to be populated with the job class
+ * @return the amount of tokens making up the prefix, -1 if it is invalid
  */
-void runCmd(char *args[], const char *const outputRedirection) {
-    if (outputRedirection != NULL) {
-        fflush(stdout);
-        const int output = open(outputRedirection, O_WRONLY | O_CREAT | O_TRUNC, 0600);
-        if (output < 0) {
-            perror("error opening file");
-            exit(127);
+static int parseBgPrefix(char *args[], int commandLength, int cmdPipeIndex, jobClass *jobClass) {
+    int skip = 1;
+    *jobClass = JOB_CLASS_DEFAULT;
+    if (args[1] != NULL && strcmp(args[1], "-c") == 0) {
+        if (args[2] == NULL || !parseJobClass(args[2], jobClass)) {
+            fprintf(stderr, "bg: classes are interactive, default and batch\n");
+            return -1;
         }
+        skip = 3;
+    }
+    // There has to be a command left, on both sides of a pipe
+    if (commandLength <= skip || (cmdPipeIndex > 0 && cmdPipeIndex - 1 <= skip)) {
+        fprintf(stderr, "bg: usage: bg [-c class] command\n");
+        return -1;
+    }
+    return skip;
+}
 
-        if (dup2(output, fileno(stdout)) < 0) {
-            perror("error redirecting stdout");
-            exit(127);
+/**
+ * Start a coprocess, coproc name command runs command in the background with its stdin and stdout on pipes.
+ * The shell's ends stay open for later commands, their fds are in the name_0 (coprocess output)
+ * and name_1 (coprocess input) environment variables, e.g. echo query > /dev/fd/N
+ * @param command command as a string, the job takes ownership of it
+ * @param args command/s (tokenized), starting with coproc
+ * @param commandLength the amount of tokens in args
+ * @param cmdPipeIndex the next index after where the pipe was found, -1 if there is no pipe
+ * @param outputRedirection where the output should be redirected, coprocesses cannot redirect their output
+ * @param audit audit record of the command line, NULL if the audit log is off
+ */
+static void coproc(char *const command, char *args[], int commandLength, int cmdPipeIndex,
+                   const char *const outputRedirection, auditRecord *const audit) {
+    const char *const name = args[1];
+    bool valid = name != NULL && (isalpha((unsigned char) *name) || *name == '_') && strlen(name) < 32;
+    for (const char *c = name; valid && *c != '\0'; ++c) {
+        valid = isalnum((unsigned char) *c) || *c == '_';
+    }
+    if (!valid || commandLength < 3 || cmdPipeIndex == 2 || cmdPipeIndex == 3 || outputRedirection != NULL) {
+        fprintf(stderr, "coproc: usage: coproc name command\n");
+        auditFinish(audit, 2 << 8, NULL);
+        free(command);
+        return;
+    }
+    for (node *cur = head; cur != NULL; cur = cur->next) {
+        if (cur->data->coproc != NULL && strcmp(cur->data->coproc, name) == 0) {
+            fprintf(stderr, "coproc: %s is already running\n", name);
+            auditFinish(audit, 1 << 8, NULL);
+            free(command);
+            return;
         }
     }
 
-    execvp(*args, args);
-    printf("Failed to execute command\n");
-    exit(127);
+    int fds[2];
+    const pid_t childPID = spawnCoprocess(args + 2, cmdPipeIndex > 0 ? cmdPipeIndex - 2 : -1, fds);
+    if (childPID < 0) {
+        perror("coproc");
+        auditFinish(audit, 127 << 8, NULL);
+        free(command);
+        return;
+    }
+
+    job *const j = addNode(command, childPID);
+    j->name = args[2];
+    j->audit = audit;
+    j->coproc = strdup(name);
+    j->coprocFds[0] = fds[0];
+    j->coprocFds[1] = fds[1];
+    STAT_ADD(jobsLaunched, 1);
+
+    const char *const suffixes[] = {"_0", "_1", "_PID"};
+    const int values[] = {fds[0], fds[1], (int) childPID};
+    char variable[64];
+    char value[16];
+    for (int i = 0; i < 3; ++i) {
+        snprintf(variable, sizeof(variable), "%s%s", name, suffixes[i]);
+        snprintf(value, sizeof(value), "%d", values[i]);
+        setenv(variable, value, 1);
+    }
+    printf("%s_0=%d %s_1=%d %s_PID=%d\n", name, fds[0], name, fds[1], name, (int) childPID);
 }
 
+// Whether the shell reads commands from a terminal, where Ctrl+C has to stop them
+static bool interactive = false;
+
 /**
  * Use the given command/s
  * @param command command as a string
@@ -340,45 +797,109 @@ void runCmd(char *args[], const char *const outputRedirection) {
  * @param background whether the command should run in the background
  * @param outputRedirection where the output should be redirected, if NULL no redirection will take place
  * @param cmdPipeIndex the next index after where the pipe was found, if -1 then no command piping will take place
+ * @param audit audit record of the command line, NULL if the audit log is off
  */
 void
 useCommand(char *const command, char *args[], int commandLength, bool background, const char *const outputRedirection,
-           int cmdPipeIndex) {
+           int cmdPipeIndex, auditRecord *const audit) {
     if (commandLength > 0) {
         if (commandLength > ARGS_SIZE) {
             printf("Arguments exceeded max size\n");
-        } else if (runBuiltIn(*args, args + 1)) {
-            free(command);
+            auditFinish(audit, 1 << 8, NULL);
         } else {
-            const pid_t childPID = fork();
-            if (childPID) {
-                if (!background) {
-                    int status = 0;
-                    waitpid(childPID, &status, WUNTRACED);
+            STAT_ADD(commands, 1);
+            jobClass jobClass = JOB_CLASS_DEFAULT;
+            if (strcmp(*args, "bg") == 0) {
+                const int skip = parseBgPrefix(args, commandLength, cmdPipeIndex, &jobClass);
+                if (skip < 0) {
+                    auditFinish(audit, 2 << 8, NULL);
                     free(command);
-                } else {
-                    addNode(command, childPID);
+                    return;
                 }
-            } else {
-                if (cmdPipeIndex > 0) {
-                    int fileDescriptors[2];
-                    pipe(fileDescriptors);
-                    if (fork() == 0) { // This is the child
-                        dup2(fileDescriptors[1], fileno(stdout));
-                        runCmd(args, outputRedirection);
-                    }
-
-                    // This is the parent
-                    dup2(fileDescriptors[0], fileno(stdin));
-                    close(fileDescriptors[1]); // Close write end of pipe
-                    runCmd(args + cmdPipeIndex, outputRedirection); // Start the commands to the right of the pipe
+                args += skip;
+                commandLength -= skip;
+                cmdPipeIndex -= cmdPipeIndex > 0 ? skip : 0;
+                background = true;
+            }
+
+            if (strcmp(*args, "coproc") == 0) {
+                STAT_ADD(externals, 1);
+                coproc(command, args, commandLength, cmdPipeIndex, outputRedirection, audit);
+                return;
+            }
+
+            const uint64_t builtinStart = traceNow();
+            if (!background && isStreamPipeline(args, cmdPipeIndex)) {
+                int status = 0;
+                struct rusage usage;
+                // The shell does not stop on Ctrl+C, at a terminal the pipeline runs in a child that does
+                fflush(stdout);
+                const pid_t childPID = interactive ? fork() : -1;
+                if (childPID == 0) {
+                    signal(SIGINT, SIG_DFL);
+                    exit(runStreamPipeline(args, outputRedirection, cmdPipeIndex));
+                }
+                if (childPID > 0) {
+                    STAT_ADD(forks, 1);
+                    waitChild(childPID, &status, &usage);
                 } else {
-                    runCmd(args, outputRedirection);
+                    status = runStreamPipeline(args, outputRedirection, cmdPipeIndex) << 8;
                 }
+                traceRecord(TRACE_BUILTIN, builtinStart, 0, *args);
+                STAT_ADD(builtins, 1);
+                auditFinish(audit, status, childPID > 0 ? &usage : NULL);
+                free(command);
+                return;
+            }
+            if (runBuiltIn(*args, args + 1)) {
+                traceRecord(TRACE_BUILTIN, builtinStart, 0, *args);
+                STAT_ADD(builtins, 1);
+                auditFinish(audit, 0, NULL);
+                free(command);
+                return;
+            }
+
+            STAT_ADD(externals, 1);
+            if (background && jobsFull()) {
+                queueJob(command, args, commandLength, outputRedirection, cmdPipeIndex, jobClass)->audit = audit;
+                return;
+            }
+
+            int pidfd;
+            jobOutput *output = NULL;
+            const pid_t childPID = background ? spawnCaptured(args, outputRedirection, cmdPipeIndex,
+                                                              jobClassNice(jobClass), &pidfd, &output)
+                                              : spawnCommand(args, outputRedirection, cmdPipeIndex, 0, NULL);
+            // The child's span starts once the fork has returned, the fork itself is traced as TRACE_FORK
+            const uint64_t childStart = traceNow();
+            if (childPID < 0) {
+                perror("fork");
+                auditFinish(audit, 127 << 8, NULL);
+                free(command);
+            } else if (!background) {
+                int status = 0;
+                struct rusage usage;
+                const uint64_t waitStart = traceNow();
+                waitChild(childPID, &status, &usage);
+                traceRecord(TRACE_WAIT, waitStart, 0, *args);
+                traceRecord(TRACE_CHILD, childStart, childPID, *args);
+                auditFinish(audit, status, &usage);
+                free(command);
+            } else {
+                job *const j = addNode(command, childPID);
+                j->name = *args;
+                j->audit = audit;
+                j->jobClass = jobClass;
+                j->pidfd = pidfd;
+                j->output = output;
+                STAT_ADD(jobsLaunched, 1);
             }
         }
-    } else if (background) {
-        printf("Command cannot run in background with no arguments\n");
+    } else {
+        auditDiscard(audit);
+        if (background) {
+            printf("Command cannot run in background with no arguments\n");
+        }
     }
 }
 
@@ -404,6 +925,44 @@ int main(void) {
     // This will ignore the CTRL+Z signal
     signal(SIGTSTP, SIG_IGN);
     parent = getpid();
+    interactive = isatty(STDIN_FILENO);
+    eventLoopSetChildHandler(reapJobs);
+
+    // The zygote and workers are forked before anything else, while the shell is still small
+    if (getenv("ASSIGNMENT1_ZYGOTE") != NULL) {
+        applyZygote(true, NULL);
+    }
+    const char *const workers = getenv("ASSIGNMENT1_WORKERS");
+    if (workers != NULL) {
+        applyWorkers(true, workers);
+    }
+    if (getenv("ASSIGNMENT1_CAPTURE_OUTPUT") != NULL) {
+        applyCaptureOutput(true, NULL);
+    }
+    const char *const tagMode = getenv("ASSIGNMENT1_TAG_OUTPUT");
+    if (tagMode != NULL) {
+        applyTagOutput(true, *tagMode != '\0' ? tagMode : NULL);
+    }
+    const char *const splitMode = getenv("ASSIGNMENT1_SPLIT_ARGS");
+    if (splitMode != NULL) {
+        applySplitArgs(true, *splitMode != '\0' ? splitMode : NULL);
+    }
+    const char *const traceFile = getenv("ASSIGNMENT1_TRACE");
+    if (traceFile != NULL && !traceOpen(traceFile)) {
+        perror("ASSIGNMENT1_TRACE");
+    }
+    const char *const statsFile = getenv("ASSIGNMENT1_STATS");
+    if (statsFile != NULL) {
+        applyStatsDump(true, statsFile);
+    }
+    const char *const metricsSocket = getenv("ASSIGNMENT1_METRICS_SOCKET");
+    if (metricsSocket != NULL) {
+        metricsOpen(metricsSocket);
+    }
+    const char *const auditLog = getenv("ASSIGNMENT1_AUDIT_LOG");
+    if (auditLog != NULL) {
+        applyAuditLog(true, auditLog);
+    }
 
     char *args[ARGS_SIZE + 1];
     char *outputRedirection = NULL;
@@ -414,14 +973,49 @@ int main(void) {
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "EndlessLoop"
     while (1) {
+        eventLoopCheckChildren();
+        // Jobs done since the last prompt are reported, at a terminal they are printed and dropped straight away,
+        // otherwise they are kept for the next command to see and dropped at the prompt after it
+        if (interactive) {
+            reportDoneJobs(true);
+            pruneReportedJobs();
+        } else {
+            pruneReportedJobs();
+            reportDoneJobs(false);
+        }
+        workerPoolFill();
         char *const cwd = getcwd(NULL, 0);
         printf("%s > ", cwd);
         fflush(stdout);
         free(cwd);
+        const uint64_t readStart = traceNow();
         char *const buffer = getLine(&bufLen);
+        traceRecord(TRACE_READ, readStart, 0, NULL);
         if (buffer != NULL) {
-            const int commandLength = getcmd(buffer, bufLen - 1, args, &background, &outputRedirection, &cmdPipeIdx);
-            useCommand(buffer, args, commandLength, background, outputRedirection, cmdPipeIdx);
+            // getcmd tokenizes in place, so the audit log needs its copy of the line first
+            auditRecord *const audit = auditStart(buffer);
+            const uint64_t tokenizeStart = traceNow();
+            int commandLength = getcmd(buffer, bufLen - 1, args, &background, &outputRedirection, &cmdPipeIdx);
+            traceRecord(TRACE_TOKENIZE, tokenizeStart, 0, NULL);
+            const char *inputRedirection;
+            const char *const rewrite = optimizePipeline(args, &commandLength, &cmdPipeIdx, background,
+                                                         &inputRedirection);
+            if (explainPlans) {
+                explainPipeline(args, cmdPipeIdx, inputRedirection, outputRedirection, background, rewrite);
+            }
+            if (inputRedirection == NULL) {
+                useCommand(buffer, args, commandLength, background, outputRedirection, cmdPipeIdx, audit);
+                continue;
+            }
+            // The command inherits the file as its stdin, the shell gets its own back before the next prompt
+            const int savedInput = redirectInput(inputRedirection);
+            if (savedInput < 0) {
+                auditFinish(audit, 1 << 8, NULL);
+                free(buffer);
+                continue;
+            }
+            useCommand(buffer, args, commandLength, background, outputRedirection, cmdPipeIdx, audit);
+            restoreInput(savedInput);
         }
     }
 #pragma clang diagnostic pop
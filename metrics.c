@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "metrics.h"
+#include "eventloop.h"
+#include "jobs.h"
+#include "stats.h"
+
+/**
+ * Serves the shell's counters and job table in Prometheus text exposition format on a Unix socket.
+ * Clients are answered from the event loop, an HTTP GET gets an HTTP response, anything else
+ * (or just shutting down the write side) gets the bare text. A response the socket cannot take at once is
+ * written as the client reads it, the connection is closed once all of it is out.
+ */
+
+#define METRICS_PREFIX "assignment1_"
+#define REQUEST_SIZE 4096
+
+typedef struct metricsResponse {
+    char *data;
+    size_t length;
+    size_t sent;
+} metricsResponse;
+
+static int listenFd = -1;
+static char *socketPath = NULL;
+
+/**
+ * Print a label value, escaped as the exposition format requires
+ * @param out stream to print to
+ * @param value label value
+ */
+static void printLabel(FILE *out, const char *value) {
+    for (; *value != '\0'; ++value) {
+        if (*value == '\\' || *value == '"') {
+            fputc('\\', out);
+            fputc(*value, out);
+        } else if (*value == '\n') {
+            fputs("\\n", out);
+        } else {
+            fputc(*value, out);
+        }
+    }
+}
+
+/**
+ * Read a process's cpu time and resident memory from /proc
+ * @param pid process to inspect
+ * @param cpuSeconds pointer to be populated with user + system time
+ * @param residentBytes pointer to be populated with the resident set size
+ * @return true if the process could be inspected
+ */
+static bool readProcStat(pid_t pid, double *cpuSeconds, long *residentBytes) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+    FILE *const file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    char line[1024];
+    const bool read = fgets(line, sizeof(line), file) != NULL;
+    fclose(file);
+    // The command name can contain spaces, so fields are counted from its closing bracket
+    const char *const fields = read ? strrchr(line, ')') : NULL;
+    unsigned long utime;
+    unsigned long stime;
+    long rss;
+    if (fields == NULL ||
+        sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+               &utime, &stime, &rss) != 3) {
+        return false;
+    }
+    *cpuSeconds = (double) (utime + stime) / (double) sysconf(_SC_CLK_TCK);
+    *residentBytes = rss * sysconf(_SC_PAGESIZE);
+    return true;
+}
+
+/**
+ * Write the exposition text for every counter and job
+ * @param out stream to write to
+ */
+static void writeMetrics(FILE *out) {
+    for (size_t i = 0; i < statCount; ++i) {
+        const uint64_t value = __atomic_load_n(statDescriptions[i].counter, __ATOMIC_RELAXED);
+        fprintf(out, "# HELP " METRICS_PREFIX "%s %s\n", statDescriptions[i].name, statDescriptions[i].help);
+        fprintf(out, "# TYPE " METRICS_PREFIX "%s counter\n", statDescriptions[i].name);
+        fprintf(out, METRICS_PREFIX "%s %.9g\n", statDescriptions[i].name, (double) value * statDescriptions[i].scale);
+    }
+
+    int count = 0;
+    for (node *cur = head; cur != NULL; cur = cur->next) {
+        ++count;
+    }
+    fprintf(out, "# HELP " METRICS_PREFIX "jobs Background jobs in the job table\n");
+    fprintf(out, "# TYPE " METRICS_PREFIX "jobs gauge\n");
+    fprintf(out, METRICS_PREFIX "jobs %d\n", count);
+
+    static const char *const jobMetrics[][2] = {
+            {"job_runtime_seconds", "Wall time since the job started"},
+            {"job_cpu_seconds",     "User and system time used by the job"},
+            {"job_resident_bytes",  "Resident memory of the job"},
+    };
+    const uint64_t now = statsNowNs();
+    for (size_t metric = 0; metric < sizeof(jobMetrics) / sizeof(*jobMetrics); ++metric) {
+        fprintf(out, "# HELP " METRICS_PREFIX "%s %s\n", jobMetrics[metric][0], jobMetrics[metric][1]);
+        fprintf(out, "# TYPE " METRICS_PREFIX "%s gauge\n", jobMetrics[metric][0]);
+        int index = 1;
+        for (node *cur = head; cur != NULL; cur = cur->next, ++index) {
+            const job *const j = cur->data;
+            double cpuSeconds = 0;
+            long residentBytes = 0;
+            if (j->state == JOB_DONE) {
+                // Reaped jobs are gone from /proc, their totals come from wait4
+                cpuSeconds = (double) j->usage.ru_utime.tv_sec + (double) j->usage.ru_utime.tv_usec / 1e6 +
+                             (double) j->usage.ru_stime.tv_sec + (double) j->usage.ru_stime.tv_usec / 1e6;
+                residentBytes = j->usage.ru_maxrss * 1024;
+            } else if (metric > 0 && !readProcStat(j->pid, &cpuSeconds, &residentBytes)) {
+                continue;
+            }
+            fprintf(out, METRICS_PREFIX "%s{job=\"%d\",pid=\"%d\",state=\"%s\",command=\"", jobMetrics[metric][0],
+                    index, (int) j->pid, jobStateName(j->state));
+            printLabel(out, j->name);
+            if (metric == 0) {
+                fprintf(out, "\"} %.3f\n", (double) ((j->state == JOB_DONE ? j->ended : now) - j->started) / 1e9);
+            } else if (metric == 1) {
+                fprintf(out, "\"} %.2f\n", cpuSeconds);
+            } else {
+                fprintf(out, "\"} %ld\n", residentBytes);
+            }
+        }
+    }
+}
+
+/**
+ * Write as much of a response as the client's socket takes
+ * @param fd client socket
+ * @param response response being written
+ * @return true if the connection is finished with, because the response is all out or the client went away
+ */
+static bool responseSend(int fd, metricsResponse *response) {
+    ssize_t n = 0;
+    while (response->sent < response->length &&
+           (n = send(fd, response->data + response->sent, response->length - response->sent, MSG_NOSIGNAL)) > 0) {
+        response->sent += (size_t) n;
+    }
+    return response->sent == response->length || n == 0 || (errno != EAGAIN && errno != EINTR);
+}
+
+/**
+ * Close a client's connection and free its response
+ * @param fd client socket
+ * @param response response written to it
+ */
+static void responseFinish(int fd, metricsResponse *response) {
+    close(fd);
+    free(response->data);
+    free(response);
+}
+
+/**
+ * Write more of a response once the client's socket is writable, closing the connection once it is all out
+ * @param fd client socket
+ * @param context the response being written
+ */
+static void metricsWrite(int fd, void *context) {
+    if (responseSend(fd, context)) {
+        eventLoopRemove(fd);
+        responseFinish(fd, context);
+    }
+}
+
+/**
+ * Answer a client once it has sent its request
+ * @param fd client socket
+ * @param context unused
+ */
+static void metricsServe(int fd, void *context) {
+    (void) context;
+    char request[REQUEST_SIZE];
+    const ssize_t n = read(fd, request, sizeof(request));
+    eventLoopRemove(fd);
+
+    char *body = NULL;
+    size_t bodyLength = 0;
+    FILE *const bodyOut = open_memstream(&body, &bodyLength);
+    writeMetrics(bodyOut);
+    fclose(bodyOut);
+
+    metricsResponse *const response = malloc(sizeof(metricsResponse));
+    FILE *const out = response != NULL ? open_memstream(&response->data, &response->length) : NULL;
+    if (out == NULL) {
+        free(response);
+        free(body);
+        close(fd);
+        return;
+    }
+    if (n >= 4 && memcmp(request, "GET ", 4) == 0) {
+        fprintf(out, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+                bodyLength);
+    }
+    fwrite(body, 1, bodyLength, out);
+    fclose(out);
+    free(body);
+    response->sent = 0;
+
+    // Whatever the socket does not take at once goes out as the client reads
+    if (responseSend(fd, response) || !eventLoopAddWritable(fd, metricsWrite, response)) {
+        responseFinish(fd, response);
+    }
+}
+
+/**
+ * Accept every pending client
+ * @param fd listening socket
+ * @param context unused
+ */
+static void metricsAccept(int fd, void *context) {
+    (void) context;
+    int client;
+    while ((client = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (!eventLoopAdd(client, metricsServe, NULL)) {
+            close(client);
+        }
+    }
+}
+
+/**
+ * Start serving metrics, replacing any socket already open
+ * @param path path of the Unix socket
+ * @return true if the socket is listening
+ */
+bool metricsOpen(const char *path) {
+    metricsClose();
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "metrics socket path too long\n");
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+        perror("metrics socket");
+        return false;
+    }
+    // Only a stale socket is replaced, never an ordinary file
+    struct stat existing;
+    if (lstat(path, &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            fprintf(stderr, "metrics socket: %s: %s\n", path, strerror(EEXIST));
+            close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+        unlink(path);
+    }
+    if (bind(listenFd, (struct sockaddr *) &address, sizeof(address)) || listen(listenFd, 16) ||
+        !eventLoopAdd(listenFd, metricsAccept, NULL)) {
+        perror("metrics socket");
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    socketPath = strdup(path);
+    return true;
+}
+
+/**
+ * Stop serving metrics and remove the socket, if one is open
+ */
+void metricsClose(void) {
+    if (listenFd < 0) {
+        return;
+    }
+    eventLoopRemove(listenFd);
+    close(listenFd);
+    unlink(socketPath);
+    free(socketPath);
+    listenFd = -1;
+    socketPath = NULL;
+}
+
+/**
+ * @return path of the socket being served, NULL if there is none
+ */
+const char *metricsPath(void) {
+    return socketPath;
+}
@@ -0,0 +1,12 @@
+#ifndef ASSIGNMENT1_METRICS_H
+#define ASSIGNMENT1_METRICS_H
+
+#include <stdbool.h>
+
+bool metricsOpen(const char *path);
+
+void metricsClose(void);
+
+const char *metricsPath(void);
+
+#endif
@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/fcntl.h>
+#include "optimize.h"
+#include "sort.h"
+#include "spawn.h"
+#include "stream.h"
+
+/**
+ * Rewrites of inefficient pipeline shapes, applied between tokenizing a line and running it.
+ * - cat file | cmd runs cmd with the file as its stdin, one process and one pass of pipe copying less.
+ * - sort | uniq -c becomes count -k, a single hash pass producing the same output without sorting every line.
+ *   count -k orders bytewise, so this is only done where sort does too, under the C or POSIX collation locale.
+ * set -o explain prints the plan of every command, with the rewrite applied to it.
+ */
+
+bool explainPlans = false;
+
+static char countCommand[] = "count";
+static char byKey[] = "-k";
+
+/**
+ * @param args a stage of a pipeline
+ * @return true if no argument of the stage is an option
+ */
+static bool hasNoOptions(char *args[]) {
+    for (++args; *args != NULL; ++args) {
+        if (**args == '-') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Rewrite a pipeline, in place
+ * @param args command/s (tokenized)
+ * @param commandLength pointer to the amount of tokens in args, updated
+ * @param cmdPipeIndex pointer to the next index after where the pipe was found, -1 if there is no pipe, updated
+ * @param background whether the command runs in the background
+ * @param inputRedirection pointer to be populated with a file to run the command with as stdin, NULL for none
+ * @return description of the rewrite, NULL if the pipeline was left alone
+ */
+const char *optimizePipeline(char *args[], int *commandLength, int *cmdPipeIndex, bool background,
+                             const char **inputRedirection) {
+    *inputRedirection = NULL;
+    if (*commandLength == 0 || *cmdPipeIndex <= 0) {
+        return NULL;
+    }
+    char **const right = args + *cmdPipeIndex;
+
+    // The file is only opened once the command runs, an unreadable one is left for cat to report
+    if (!background && strcmp(*args, "cat") == 0 && args[1] != NULL && *args[1] != '-' && args[2] == NULL &&
+        access(args[1], R_OK) == 0) {
+        *inputRedirection = args[1];
+        const int rightLength = *commandLength - *cmdPipeIndex;
+        memmove(args, right, sizeof(char *) * ((size_t) rightLength + 1));
+        *commandLength = rightLength;
+        *cmdPipeIndex = -1;
+        return "cat file | cmd -> cmd < file";
+    }
+
+    if (strcmp(*args, "sort") == 0 && hasNoOptions(args) && sortCollatesBytewise() &&
+        strcmp(*right, "uniq") == 0 && right[1] != NULL && strcmp(right[1], "-c") == 0 && right[2] == NULL) {
+        // Files of sort stay as the files of count, moved one up for the option
+        int files = 0;
+        while (args[1 + files] != NULL) {
+            ++files;
+        }
+        memmove(args + 2, args + 1, sizeof(char *) * (size_t) files);
+        args[0] = countCommand;
+        args[1] = byKey;
+        args[2 + files] = NULL;
+        *commandLength = 2 + files;
+        *cmdPipeIndex = -1;
+        return "sort | uniq -c -> count -k";
+    }
+    return NULL;
+}
+
+/**
+ * Print the plan of a command to stderr, for set -o explain
+ * @param args command/s (tokenized), after rewriting
+ * @param cmdPipeIndex the next index after where the pipe was found, -1 if there is no pipe
+ * @param inputRedirection file the command runs with as stdin, NULL for none
+ * @param outputRedirection where the output is redirected, NULL for none
+ * @param background whether the command runs in the background
+ * @param rewrite description of the rewrite applied, NULL if there was none
+ */
+void explainPipeline(char *args[], int cmdPipeIndex, const char *inputRedirection, const char *outputRedirection,
+                     bool background, const char *rewrite) {
+    if (*args == NULL) {
+        return;
+    }
+    fflush(stdout);
+    fprintf(stderr, "explain:");
+    for (char **arg = args; *arg != NULL; ++arg) {
+        fprintf(stderr, " %s", *arg);
+    }
+    if (cmdPipeIndex > 0) {
+        fprintf(stderr, " |");
+        for (char **arg = args + cmdPipeIndex; *arg != NULL; ++arg) {
+            fprintf(stderr, " %s", *arg);
+        }
+    }
+    if (inputRedirection != NULL) {
+        fprintf(stderr, " < %s", inputRedirection);
+    }
+    if (outputRedirection != NULL) {
+        fprintf(stderr, " > %s", outputRedirection);
+    }
+    fprintf(stderr, "%s", background ? " &" : "");
+    if (!background && isStreamPipeline(args, cmdPipeIndex)) {
+        fprintf(stderr, "  [in-process]");
+    }
+    fprintf(stderr, rewrite != NULL ? "  [rewrote %s]\n" : "\n", rewrite);
+}
+
+/**
+ * Move the shell's stdin onto a file, so the command run next inherits it
+ * @param path file to read
+ * @return fd holding the shell's own stdin, to restore it with, -1 if the file could not be opened
+ */
+int redirectInput(const char *path) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "cat: %s: ", path);
+        perror(NULL);
+        return -1;
+    }
+    const int saved = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+    if (saved < 0) {
+        perror("cat");
+        close(fd);
+        return -1;
+    }
+    dup2(fd, STDIN_FILENO);
+    close(fd);
+    inputMoved = true;
+    return saved;
+}
+
+/**
+ * Give the shell its own stdin back
+ * @param saved fd returned by redirectInput
+ */
+void restoreInput(int saved) {
+    dup2(saved, STDIN_FILENO);
+    close(saved);
+    inputMoved = false;
+}
@@ -0,0 +1,19 @@
+#ifndef ASSIGNMENT1_OPTIMIZE_H
+#define ASSIGNMENT1_OPTIMIZE_H
+
+#include <stdbool.h>
+
+// Whether the plan of every command is printed, the explain option
+extern bool explainPlans;
+
+const char *optimizePipeline(char *args[], int *commandLength, int *cmdPipeIndex, bool background,
+                             const char **inputRedirection);
+
+void explainPipeline(char *args[], int cmdPipeIndex, const char *inputRedirection, const char *outputRedirection,
+                     bool background, const char *rewrite);
+
+int redirectInput(const char *path);
+
+void restoreInput(int saved);
+
+#endif
@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "parallel.h"
+
+/**
+ * The parallel --pipe stream builtin, splitting its input into chunks of whole lines spread over N copies of a
+ * command, each reading its chunks on stdin. A chunk goes to the first copy whose pipe has room, or strictly in
+ * turn with --rr. When the input is a regular file the chunk boundaries are found in a mapping of it and the chunks
+ * are spliced from the file into the pipes, so the payload never passes through the shell's memory. Any other
+ * input is read through a buffer, since finding line ends needs the bytes.
+ * It starts processes of its own, so it always runs in a child rather than on a thread of the shell.
+ */
+
+#define PARALLEL_DEFAULT_BLOCK (1UL << 20)
+#define PARALLEL_MAX_JOBS 256
+
+typedef struct pipeWorker {
+    pid_t pid;
+    // Write end of the worker's stdin, -1 once the worker is gone
+    int fd;
+} pipeWorker;
+
+typedef struct pipeWorkers {
+    pipeWorker workers[PARALLEL_MAX_JOBS];
+    int count;
+    int alive;
+    // Worker after the one that got the last chunk
+    int next;
+    bool roundRobin;
+} pipeWorkers;
+
+/**
+ * Start the copies of the command
+ * @param pool pool to populate
+ * @param count amount of copies
+ * @param args command (tokenized)
+ * @param output fd the copies write to
+ * @return false if no copy could be started
+ */
+static bool startWorkers(pipeWorkers *pool, int count, char *args[], int output) {
+    for (int i = 0; i < count; ++i) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC)) {
+            break;
+        }
+        fflush(stdout);
+        const pid_t pid = fork();
+        if (pid == 0) {
+            dup2(fds[0], STDIN_FILENO);
+            if (output != STDOUT_FILENO) {
+                dup2(output, STDOUT_FILENO);
+            }
+            signal(SIGPIPE, SIG_DFL);
+            execvp(*args, args);
+            fprintf(stderr, "parallel: %s: %s\n", *args, strerror(errno));
+            _exit(127);
+        }
+        close(fds[0]);
+        if (pid < 0) {
+            close(fds[1]);
+            break;
+        }
+        pool->workers[pool->count++] = (pipeWorker) {pid, fds[1]};
+    }
+    pool->alive = pool->count;
+    return pool->count > 0;
+}
+
+/**
+ * Pick the worker for the next chunk
+ * @param pool the workers
+ * @return the worker, NULL if every worker is gone
+ */
+static pipeWorker *nextWorker(pipeWorkers *pool) {
+    if (pool->alive == 0) {
+        return NULL;
+    }
+    if (!pool->roundRobin) {
+        // The first worker, in turn, whose pipe has room, i.e. one that has caught up with its chunks
+        struct pollfd fds[PARALLEL_MAX_JOBS];
+        for (int i = 0; i < pool->count; ++i) {
+            fds[i] = (struct pollfd) {pool->workers[i].fd, POLLOUT, 0};
+        }
+        while (poll(fds, (nfds_t) pool->count, -1) < 0 && errno == EINTR);
+        for (int i = 0; i < pool->count; ++i) {
+            const int w = (pool->next + i) % pool->count;
+            if (fds[w].revents != 0 && pool->workers[w].fd >= 0) {
+                pool->next = w;
+                break;
+            }
+        }
+    }
+    while (pool->workers[pool->next].fd < 0) {
+        pool->next = (pool->next + 1) % pool->count;
+    }
+    pipeWorker *const w = &pool->workers[pool->next];
+    pool->next = (pool->next + 1) % pool->count;
+    return w;
+}
+
+/**
+ * Stop sending to a worker that has gone away
+ * @param pool the workers
+ * @param w the worker
+ */
+static void dropWorker(pipeWorkers *pool, pipeWorker *w) {
+    close(w->fd);
+    w->fd = -1;
+    --pool->alive;
+}
+
+/**
+ * Send a chunk of a regular file to workers without copying it, splicing from the file into their pipes
+ * @param pool the workers
+ * @param fd the file
+ * @param name name of the input, for errors
+ * @param blockSize approximate size of a chunk
+ * @return false if the file could not be read
+ */
+static bool spliceFile(pipeWorkers *pool, int fd, const char *name, size_t blockSize) {
+    struct stat st;
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (fstat(fd, &st) || offset < 0) {
+        fprintf(stderr, "parallel: %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    const off_t size = st.st_size;
+    // Only the pages around chunk boundaries are ever touched
+    const char *const data = size > 0 ? mmap(NULL, (size_t) size, PROT_READ, MAP_SHARED, fd, 0) : NULL;
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "parallel: %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    while (offset < size) {
+        off_t end = size;
+        if ((off_t) blockSize < size - offset) {
+            const char *const newline = memchr(data + offset + blockSize - 1, '\n',
+                                               (size_t) (size - offset - (off_t) blockSize + 1));
+            end = newline != NULL ? newline - data + 1 : size;
+        }
+        pipeWorker *const w = nextWorker(pool);
+        if (w == NULL) {
+            break;
+        }
+        while (offset < end) {
+            const ssize_t n = splice(fd, &offset, w->fd, NULL, (size_t) (end - offset), SPLICE_F_MOVE);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                // The worker exited, the rest of its chunk is lost like with a closed pipe
+                dropWorker(pool, w);
+                offset = end;
+            }
+        }
+    }
+    if (data != NULL) {
+        munmap((void *) data, (size_t) size);
+    }
+    return true;
+}
+
+/**
+ * Write all of a chunk to a worker
+ * @param fd write end of the worker's pipe
+ * @param buffer the chunk
+ * @param size amount of bytes
+ * @return false if the worker has gone away
+ */
+static bool writeChunk(int fd, const char *buffer, size_t size) {
+    while (size > 0) {
+        const ssize_t n = write(fd, buffer, size);
+        if (n < 0 && errno != EINTR) {
+            return false;
+        }
+        buffer += n > 0 ? n : 0;
+        size -= n > 0 ? (size_t) n : 0;
+    }
+    return true;
+}
+
+/**
+ * Send an input that cannot be mapped to workers through a buffer, cutting chunks at the last line end
+ * @param pool the workers
+ * @param in the input
+ * @param name name of the input, for errors
+ * @param blockSize approximate size of a chunk
+ * @return false if the input could not be read
+ */
+static bool copyStream(pipeWorkers *pool, stream *in, const char *name, size_t blockSize) {
+    size_t capacity = blockSize;
+    char *buffer = malloc(capacity);
+    size_t used = 0;
+    ssize_t n = 0;
+    bool ended = false;
+    while (pool->alive > 0 && (!ended || used > 0)) {
+        while (used < blockSize && !ended) {
+            n = streamRead(in, buffer + used, capacity - used);
+            ended = n <= 0;
+            used += n > 0 ? (size_t) n : 0;
+        }
+        // A chunk ends after its last line, a line longer than a block grows the buffer until it ends
+        size_t length = used;
+        if (!ended) {
+            const char *const newline = memrchr(buffer, '\n', used);
+            if (newline == NULL) {
+                if (used == capacity) {
+                    capacity *= 2;
+                    buffer = realloc(buffer, capacity);
+                }
+                n = streamRead(in, buffer + used, capacity - used);
+                ended = n <= 0;
+                used += n > 0 ? (size_t) n : 0;
+                continue;
+            }
+            length = (size_t) (newline + 1 - buffer);
+        }
+        pipeWorker *const w = nextWorker(pool);
+        if (w != NULL && !writeChunk(w->fd, buffer, length)) {
+            dropWorker(pool, w);
+        }
+        memmove(buffer, buffer + length, used - length);
+        used -= length;
+    }
+    free(buffer);
+    if (n < 0) {
+        fprintf(stderr, "parallel: %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Parse a block size such as 512K, 64M or 2G
+ * @param text size to parse
+ * @param size populated with the size in bytes
+ * @return false if it is not a valid size
+ */
+static bool parseBlockSize(const char *text, size_t *size) {
+    char *end;
+    const unsigned long long value = strtoull(text, &end, 10);
+    const char *const units = "kmg";
+    const char *const unit = *end != '\0' ? strchr(units, *end | 0x20) : NULL;
+    if (end == text || value == 0 || (*end != '\0' && (unit == NULL || end[1] != '\0'))) {
+        return false;
+    }
+    *size = (size_t) value << (unit != NULL ? 10 * (unit - units + 1) : 0);
+    return true;
+}
+
+/**
+ * Executes the parallel command
+ * @param params --pipe, then -j N for the amount of copies (default the number of cpus), --block size for the
+ * approximate size of a chunk (default 1M), --rr to hand out chunks strictly in turn, -a file to read the file
+ * rather than the input, then the command
+ * @param in input of the command, split between the copies
+ * @param out output of the command, shared by the copies
+ * @return exit status, the first non-zero status of a copy
+ */
+int parallel(char *params[], stream *in, stream *out) {
+    if (*params == NULL || strcmp(*params, "--pipe") != 0) {
+        fprintf(stderr, "parallel: usage: parallel --pipe [-j N] [--block size] [--rr] [-a file] command\n");
+        return 2;
+    }
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t blockSize = PARALLEL_DEFAULT_BLOCK;
+    pipeWorkers pool = {.count = 0};
+    const char *file = NULL;
+    for (++params; *params != NULL && **params == '-'; ++params) {
+        if (strncmp(*params, "-j", 2) == 0 && ((*params)[2] != '\0' || params[1] != NULL)) {
+            jobs = strtol((*params)[2] != '\0' ? *params + 2 : *++params, NULL, 10);
+            if (jobs < 1 || jobs > PARALLEL_MAX_JOBS) {
+                fprintf(stderr, "parallel: -j must be between 1 and %d\n", PARALLEL_MAX_JOBS);
+                return 2;
+            }
+        } else if (strcmp(*params, "--block") == 0 && params[1] != NULL) {
+            if (!parseBlockSize(*++params, &blockSize)) {
+                fprintf(stderr, "parallel: invalid block size %s\n", *params);
+                return 2;
+            }
+        } else if (strncmp(*params, "-a", 2) == 0 && ((*params)[2] != '\0' || params[1] != NULL)) {
+            file = (*params)[2] != '\0' ? *params + 2 : *++params;
+        } else if (strcmp(*params, "--rr") == 0) {
+            pool.roundRobin = true;
+        } else {
+            fprintf(stderr, "parallel: invalid option %s\n", *params);
+            return 2;
+        }
+    }
+    if (*params == NULL) {
+        fprintf(stderr, "parallel: no command given\n");
+        return 2;
+    }
+
+    stream input = *in;
+    if (file != NULL && !streamOpen(&input, file)) {
+        fprintf(stderr, "parallel: %s: %s\n", file, strerror(errno));
+        return 1;
+    }
+    // Anything the shell printed must come out before the copies' output
+    streamFlush(out);
+    // A copy exiting early must not kill the builtin
+    signal(SIGPIPE, SIG_IGN);
+    if (!startWorkers(&pool, (int) (jobs < PARALLEL_MAX_JOBS ? jobs : PARALLEL_MAX_JOBS), params, out->fd)) {
+        perror("parallel");
+        return 1;
+    }
+    const char *const name = file != NULL ? file : "stdin";
+    struct stat st;
+    const bool ok = input.ring == NULL && fstat(input.fd, &st) == 0 && S_ISREG(st.st_mode)
+                    ? spliceFile(&pool, input.fd, name, blockSize) : copyStream(&pool, &input, name, blockSize);
+    if (file != NULL) {
+        close(input.fd);
+    }
+
+    int result = ok ? 0 : 1;
+    for (int i = 0; i < pool.count; ++i) {
+        if (pool.workers[i].fd >= 0) {
+            close(pool.workers[i].fd);
+        }
+    }
+    for (int i = 0; i < pool.count; ++i) {
+        int status;
+        while (waitpid(pool.workers[i].pid, &status, 0) < 0 && errno == EINTR);
+        const int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        result = result == 0 ? code : result;
+    }
+    return result;
+}
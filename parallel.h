@@ -0,0 +1,8 @@
+#ifndef ASSIGNMENT1_PARALLEL_H
+#define ASSIGNMENT1_PARALLEL_H
+
+#include "stream.h"
+
+int parallel(char *params[], stream *in, stream *out);
+
+#endif
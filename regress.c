@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/**
+ * Drives the shell non-interactively with scripted command lines and compares what it prints with the output of
+ * the system tools, so the stream builtins, the pipeline rewrites and the ordered tag output are checked end to end.
+ * Every case runs once with each event loop backend, with the metrics socket served so the loop is in use.
+ * Usage: regress [-s shell] [case...]
+ */
+
+#ifndef ASSIGNMENT1_PATH
+#define ASSIGNMENT1_PATH "./assignment1"
+#endif
+
+#define COMMAND_SIZE 1024
+#define INPUT_LINES 2000
+#define WORD_LINES 5000
+#define NUMBER_LINES 1000
+#define BIG_LINES 200000
+#define NAME_SIZE 64
+// Seconds a shell may take for one case before it is killed as hung
+#define RUN_TIMEOUT 20
+
+typedef struct regressCase {
+    const char *name;
+    // Command line run by the shell
+    const char *line;
+    // Command run by /bin/sh, the shell must print exactly what it prints
+    const char *reference;
+    // What set -o explain prints for the line, NULL to not check it
+    const char *plan;
+    // LC_ALL both commands run with, NULL for C
+    const char *locale;
+    // Fixture the case reads, the case is skipped when it could not be made
+    const char *fixture;
+} regressCase;
+
+static const regressCase cases[] = {
+        {"cat",           "cat input",                "cat input",                  NULL,                                                                          NULL,      NULL},
+        {"cat-pipeline",  "cat input | cat",          "cat input",                  "explain: cat < input  [in-process]  [rewrote cat file | cmd -> cmd < file]",  NULL,      NULL},
+        {"cat-fallback",  "cat -n input",             "cat -n input",               NULL,                                                                          NULL,      NULL},
+        {"cat-rewrite",   "cat words | wc -l",        "wc -l < words",              "explain: wc -l < words  [rewrote cat file | cmd -> cmd < file]",              NULL,      NULL},
+        {"sort",          "sort words",               "sort words",                 NULL,                                                                          NULL,      NULL},
+        {"sort-reverse",  "sort -r words",            "sort -r words",              NULL,                                                                          NULL,      NULL},
+        {"sort-external", "sort -S 1M big",           "sort big",                   NULL,                                                                          NULL,      NULL},
+        {"sort-fallback", "sort -n numbers",          "sort -n numbers",            NULL,                                                                          NULL,      NULL},
+        {"sort-size",     "sort -S 50% words",        "sort -S 50% words",          NULL,                                                                          NULL,      NULL},
+        {"sort-locale",   "sort words",               "sort words",                 NULL,                                                                          "C.UTF-8", NULL},
+        {"count",         "count -k words",           "sort words | uniq -c",       NULL,                                                                          NULL,      NULL},
+        {"count-rewrite", "sort words | uniq -c",     "sort words | uniq -c",       "explain: count -k words  [in-process]  [rewrote sort | uniq -c -> count -k]", NULL,      NULL},
+        {"count-locale",  "sort words | uniq -c",     "sort words | uniq -c",       "explain: sort words | uniq -c",                                               "C.UTF-8", NULL},
+        {"fields",        "fields 1,3 table",         "awk '{print $1, $3}' table", NULL,                                                                          NULL,      NULL},
+        {"fields-cut",    "fields -d : 2-3,5 passwd", "cut -d : -f 2-3,5 passwd",   NULL,                                                                          NULL,      NULL},
+        {"zcat",          "zcat input.gz",            "gzip -dc input.gz",          NULL,                                                                          NULL,      "input.gz"},
+        {"zcat-stdout",   "zcat -c input.gz",         "gzip -dc input.gz",          NULL,                                                                          NULL,      "input.gz"},
+        {"zstdcat",       "zstdcat input.zst",        "zstd -dcq input.zst",        NULL,                                                                          NULL,      "input.zst"},
+};
+
+// Values of ASSIGNMENT1_EVENT_LOOP the cases run with
+static const char *const eventLoops[] = {"io_uring", "epoll"};
+
+/**
+ * Next value of a fixed linear congruential generator, so the fixtures are the same on every run
+ * @param state generator state
+ * @return pseudo-random value
+ */
+static unsigned int nextRandom(uint64_t *const state) {
+    *state = *state * 6364136223846793005u + 1442695040888963407u;
+    return (unsigned int) (*state >> 33);
+}
+
+/**
+ * Write the input files the cases read into the current directory
+ * @return true if every file the shell's own builtins read was written
+ */
+static bool writeFixtures(void) {
+    static const char *const vocabulary[] = {"apple", "Banana", "cherry", "apple pie", "", "zebra", "\xc3\xa9" "clair",
+                                             "  leading", "trailing  ", "42", "apple"};
+    const size_t vocabularySize = sizeof(vocabulary) / sizeof(*vocabulary);
+    uint64_t state = 1;
+    FILE *const input = fopen("input", "w");
+    FILE *const words = fopen("words", "w");
+    FILE *const numbers = fopen("numbers", "w");
+    FILE *const big = fopen("big", "w");
+    FILE *const table = fopen("table", "w");
+    FILE *const passwd = fopen("passwd", "w");
+    bool ok = input != NULL && words != NULL && numbers != NULL && big != NULL && table != NULL && passwd != NULL;
+    for (int i = 0; ok && i < INPUT_LINES; ++i) {
+        fprintf(input, "line %d of the input\n", i);
+        fprintf(table, "%s\t %d  x%u y\n", vocabulary[i % vocabularySize], i, nextRandom(&state) % 1000);
+        fprintf(passwd, "user%d:x:%d:%d::/home/user%d:/bin/sh\n", i, 1000 + i, nextRandom(&state) % 100, i);
+    }
+    for (int i = 0; ok && i < WORD_LINES; ++i) {
+        fprintf(words, "%s\n", vocabulary[nextRandom(&state) % vocabularySize]);
+    }
+    for (int i = 0; ok && i < NUMBER_LINES; ++i) {
+        fprintf(numbers, "%u\n", nextRandom(&state) % 100000);
+    }
+    for (int i = 0; ok && i < BIG_LINES; ++i) {
+        fprintf(big, "%08x %d\n", nextRandom(&state), i);
+    }
+    // The slow job prints after the fast one, ordered tag output must still show it first
+    FILE *const slow = fopen("slow.sh", "w");
+    FILE *const fast = fopen("fast.sh", "w");
+    ok &= slow != NULL && fast != NULL;
+    if (ok) {
+        fprintf(slow, "sleep 0.3\necho A\n");
+        fprintf(fast, "echo B1\necho B2\n");
+    }
+    FILE *const files[] = {input, words, numbers, big, table, passwd, slow, fast};
+    for (size_t i = 0; i < sizeof(files) / sizeof(*files); ++i) {
+        if (files[i] != NULL) {
+            ok &= fclose(files[i]) == 0;
+        }
+    }
+
+    // Compressed fixtures need the system tools, their cases are skipped without them
+    system("gzip -c input > input.gz 2> /dev/null || rm -f input.gz");
+    system("zstd -qc input > input.zst 2> /dev/null || rm -f input.zst");
+    return ok;
+}
+
+/**
+ * Run a script in a fresh shell, in its own session so its exit does not signal the driver.
+ * The script is read from a regular file, which the event loop cannot poll like a terminal or a pipe.
+ * @param path path to the shell binary
+ * @param script command lines to send, ending with exit
+ * @param name name of the run, its stdout and stderr are written to name.out and name.err
+ * @return true if the shell ran and exited in time
+ */
+static bool runShell(const char *const path, const char *const script, const char *const name) {
+    char scriptPath[NAME_SIZE + 8];
+    char outputPath[NAME_SIZE + 8];
+    char errorPath[NAME_SIZE + 8];
+    snprintf(scriptPath, sizeof(scriptPath), "%s.script", name);
+    snprintf(outputPath, sizeof(outputPath), "%s.out", name);
+    snprintf(errorPath, sizeof(errorPath), "%s.err", name);
+    FILE *const file = fopen(scriptPath, "w");
+    if (file == NULL || fputs(script, file) == EOF || fclose(file) != 0) {
+        perror(scriptPath);
+        return false;
+    }
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+    if (pid == 0) {
+        setsid();
+        const int input = open(scriptPath, O_RDONLY);
+        const int output = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        const int error = open(errorPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (input < 0 || output < 0 || error < 0) {
+            perror("regress");
+            exit(127);
+        }
+        dup2(input, STDIN_FILENO);
+        dup2(output, STDOUT_FILENO);
+        dup2(error, STDERR_FILENO);
+        close(input);
+        close(output);
+        close(error);
+        // The alarm survives exec, a hung shell is killed by it
+        alarm(RUN_TIMEOUT);
+        execl(path, path, (char *) NULL);
+        perror(path);
+        exit(127);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM) {
+        fprintf(stderr, "%s: shell hung, killed after %d seconds\n", name, RUN_TIMEOUT);
+        return false;
+    }
+    // exit signals the shell's whole session, so it ends killed by SIGTERM
+    return !(WIFEXITED(status) && WEXITSTATUS(status) == 127);
+}
+
+/**
+ * Read a whole file
+ * @param path file to read
+ * @param length set to the length of the file
+ * @return contents of the file, NUL terminated, NULL if it could not be read
+ */
+static char *readFile(const char *const path, size_t *const length) {
+    FILE *const file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    size_t size = 4096;
+    char *buffer = malloc(size);
+    *length = 0;
+    size_t n;
+    while (buffer != NULL && (n = fread(buffer + *length, 1, size - *length - 1, file)) > 0) {
+        *length += n;
+        if (size - *length == 1) {
+            size *= 2;
+            char *const grown = realloc(buffer, size);
+            if (grown == NULL) {
+                free(buffer);
+            }
+            buffer = grown;
+        }
+    }
+    fclose(file);
+    if (buffer != NULL) {
+        buffer[*length] = '\0';
+    }
+    return buffer;
+}
+
+/**
+ * Remove every prompt from the shell's output, leaving what the commands printed
+ * @param buffer output of the shell, NUL terminated
+ * @param length length of the output, updated
+ * @param prompt prompt printed by the shell
+ */
+static void stripPrompts(char *const buffer, size_t *const length, const char *const prompt) {
+    const size_t promptLength = strlen(prompt);
+    size_t kept = 0;
+    for (size_t i = 0; i < *length;) {
+        if (strncmp(buffer + i, prompt, promptLength) == 0) {
+            i += promptLength;
+        } else {
+            buffer[kept++] = buffer[i++];
+        }
+    }
+    buffer[kept] = '\0';
+    *length = kept;
+}
+
+/**
+ * @param text output of a command
+ * @param line a line without its newline
+ * @return true if the output has the whole line
+ */
+static bool printedLine(const char *const text, const char *const line) {
+    const size_t length = strlen(line);
+    for (const char *found = strstr(text, line); found != NULL; found = strstr(found + 1, line)) {
+        if ((found == text || found[-1] == '\n') && found[length] == '\n') {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Run one case and compare the shell's output with the reference
+ * @param path path to the shell binary
+ * @param c case to run
+ * @param eventLoop event loop backend the shell uses
+ * @param prompt prompt printed by the shell
+ * @return true if the case passed or was skipped
+ */
+static bool runCase(const char *const path, const regressCase *const c, const char *const eventLoop,
+                    const char *const prompt) {
+    char name[NAME_SIZE];
+    snprintf(name, sizeof(name), "%s-%s", c->name, eventLoop);
+    if (c->fixture != NULL && access(c->fixture, R_OK) != 0) {
+        printf("%-24s skipped, no %s\n", name, c->fixture);
+        return true;
+    }
+
+    setenv("LC_ALL", c->locale != NULL ? c->locale : "C", 1);
+    char script[COMMAND_SIZE];
+    char command[COMMAND_SIZE];
+    snprintf(script, sizeof(script), "%s%s\nexit\n", c->plan != NULL ? "set -o explain\n" : "", c->line);
+    snprintf(command, sizeof(command), "%s > %s.expected", c->reference, name);
+    if (system(command) != 0 || !runShell(path, script, name)) {
+        printf("%-24s FAILED, could not run `%s`\n", name, c->line);
+        return false;
+    }
+
+    char outputPath[NAME_SIZE + 8];
+    char errorPath[NAME_SIZE + 8];
+    char expectedPath[NAME_SIZE + 16];
+    snprintf(outputPath, sizeof(outputPath), "%s.out", name);
+    snprintf(errorPath, sizeof(errorPath), "%s.err", name);
+    snprintf(expectedPath, sizeof(expectedPath), "%s.expected", name);
+    size_t outputLength = 0;
+    size_t expectedLength = 0;
+    size_t errorLength = 0;
+    char *const output = readFile(outputPath, &outputLength);
+    char *const expected = readFile(expectedPath, &expectedLength);
+    char *const error = readFile(errorPath, &errorLength);
+    bool ok = output != NULL && expected != NULL && error != NULL;
+    if (ok) {
+        stripPrompts(output, &outputLength, prompt);
+        if (outputLength != expectedLength || memcmp(output, expected, outputLength) != 0) {
+            printf("%-24s FAILED, `%s` printed %s, `%s` printed %s\n", name, c->line, outputPath, c->reference,
+                   expectedPath);
+            ok = false;
+        } else if (c->plan != NULL && !printedLine(error, c->plan)) {
+            printf("%-24s FAILED, set -o explain did not print `%s`, see %s\n", name, c->plan, errorPath);
+            ok = false;
+        } else {
+            printf("%-24s ok\n", name);
+        }
+    }
+    free(output);
+    free(expected);
+    free(error);
+    return ok;
+}
+
+/**
+ * Check that ordered tag output shows a job's lines only after every job started before it, also when the jobs
+ * are brought to the foreground out of order
+ * @param path path to the shell binary
+ * @param eventLoop event loop backend the shell uses
+ * @return true if the lines came out in start order
+ */
+static bool runOrderedTags(const char *const path, const char *const eventLoop) {
+    char name[NAME_SIZE];
+    snprintf(name, sizeof(name), "tag-ordered-%s", eventLoop);
+    if (!runShell(path, "set -o tag-output=ordered\nsh slow.sh &\nsh fast.sh &\nfg 2\nfg\nexit\n", name)) {
+        printf("%-24s FAILED, could not run the shell\n", name);
+        return false;
+    }
+
+    char outputPath[NAME_SIZE + 8];
+    snprintf(outputPath, sizeof(outputPath), "%s.out", name);
+    size_t length = 0;
+    char *const output = readFile(outputPath, &length);
+    const char *const a = output != NULL ? strstr(output, "]: A\n") : NULL;
+    const char *const b1 = a != NULL ? strstr(a, "]: B1\n") : NULL;
+    const char *const b2 = b1 != NULL ? strstr(b1, "]: B2\n") : NULL;
+    const bool ok = b2 != NULL;
+    if (ok) {
+        printf("%-24s ok\n", name);
+    } else {
+        printf("%-24s FAILED, lines not in start order, see %s\n", name, outputPath);
+    }
+    free(output);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = ASSIGNMENT1_PATH;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        if (opt == 's') {
+            path = optarg;
+        } else {
+            fprintf(stderr, "usage: %s [-s shell] [case...]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // Run from a fixed directory so the prompt is known in advance
+    char dir[] = "/tmp/assignment1-regress-XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir)) {
+        perror("regress");
+        return 1;
+    }
+    char prompt[sizeof(dir) + 4];
+    snprintf(prompt, sizeof(prompt), "%s > ", dir);
+    signal(SIGPIPE, SIG_IGN);
+    if (!writeFixtures()) {
+        perror("regress: fixtures");
+        return 1;
+    }
+    // The event loop only runs while the shell has something to watch besides its input
+    setenv("ASSIGNMENT1_METRICS_SOCKET", "metrics.sock", 1);
+
+    bool ok = true;
+    const size_t caseCount = sizeof(cases) / sizeof(*cases);
+    for (size_t loop = 0; loop < sizeof(eventLoops) / sizeof(*eventLoops); ++loop) {
+        setenv("ASSIGNMENT1_EVENT_LOOP", eventLoops[loop], 1);
+        for (size_t i = 0; i <= caseCount; ++i) {
+            const char *const name = i < caseCount ? cases[i].name : "tag-ordered";
+            bool selected = optind == argc;
+            for (int arg = optind; arg < argc; ++arg) {
+                selected |= strcmp(argv[arg], name) == 0;
+            }
+            if (selected) {
+                ok &= i < caseCount ? runCase(path, &cases[i], eventLoops[loop], prompt)
+                                    : runOrderedTags(path, eventLoops[loop]);
+            }
+        }
+    }
+
+    if (ok) {
+        char command[sizeof(dir) + 16];
+        snprintf(command, sizeof(command), "rm -rf %s", dir);
+        system(command);
+    } else {
+        printf("output kept in %s\n", dir);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "request.h"
+
+/**
+ * Encoding of the requests the shell sends to its workers and zygote over a Unix socket.
+ * A request is a fixed header followed by NUL terminated strings (cwd, argv, environment, ...), in one message,
+ * with the fds it passes attached (SCM_RIGHTS).
+ */
+
+/**
+ * Copy a string into a request
+ * @param buffer request buffer
+ * @param length pointer to the current length of the request, updated
+ * @param value string to append, including its NUL
+ * @return false if it does not fit
+ */
+bool requestAppendString(char *buffer, size_t *length, const char *value) {
+    const size_t size = strlen(value) + 1;
+    if (*length + size > REQUEST_SIZE) {
+        return false;
+    }
+    memcpy(buffer + *length, value, size);
+    *length += size;
+    return true;
+}
+
+/**
+ * Take the next string out of a request
+ * @param cursor pointer to the current position in the request, updated
+ * @param end end of the request
+ * @return the string, NULL if the request is truncated
+ */
+char *requestTakeString(char **cursor, const char *end) {
+    char *const value = *cursor;
+    char *const nul = value < end ? memchr(value, '\0', (size_t) (end - value)) : NULL;
+    if (nul == NULL) {
+        return NULL;
+    }
+    *cursor = nul + 1;
+    return value;
+}
+
+/**
+ * Send a request, or a reply, in one message with fds attached
+ * @param socket Unix socket to send on
+ * @param data the message
+ * @param length length of the message
+ * @param fds fds to pass, may be NULL if there are none
+ * @param fdCount amount of fds, at most REQUEST_MAX_FDS
+ * @return result of sendmsg
+ */
+ssize_t requestSend(int socket, const void *data, size_t length, const int *fds, int fdCount) {
+    char control[CMSG_SPACE(sizeof(int) * REQUEST_MAX_FDS)];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {(void *) data, length};
+    struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1};
+    if (fdCount > 0) {
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t) fdCount);
+        struct cmsghdr *const c = CMSG_FIRSTHDR(&message);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int) * (size_t) fdCount);
+        memcpy(CMSG_DATA(c), fds, sizeof(int) * (size_t) fdCount);
+    }
+    ssize_t n;
+    while ((n = sendmsg(socket, &message, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+    return n;
+}
+
+/**
+ * Receive a request, or a reply, along with the fds attached to it, which are close-on-exec
+ * @param socket Unix socket to receive from
+ * @param data buffer to be populated with the message
+ * @param size size of the buffer
+ * @param fds array to be populated with the fds
+ * @param fdCount pointer to be populated with the amount of fds
+ * @return result of recvmsg
+ */
+ssize_t requestReceive(int socket, void *data, size_t size, int fds[REQUEST_MAX_FDS], int *fdCount) {
+    char control[CMSG_SPACE(sizeof(int) * REQUEST_MAX_FDS)];
+    struct iovec iov = {data, size};
+    struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control,
+            .msg_controllen = sizeof(control)};
+    ssize_t n;
+    while ((n = recvmsg(socket, &message, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+    *fdCount = 0;
+    for (struct cmsghdr *c = n >= 0 ? CMSG_FIRSTHDR(&message) : NULL; c != NULL; c = CMSG_NXTHDR(&message, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+            *fdCount = (int) ((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            memcpy(fds, CMSG_DATA(c), sizeof(int) * (size_t) *fdCount);
+        }
+    }
+    return n;
+}
@@ -0,0 +1,21 @@
+#ifndef ASSIGNMENT1_REQUEST_H
+#define ASSIGNMENT1_REQUEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Largest request sent to a worker or the zygote, header and strings included
+#define REQUEST_SIZE 65536
+// Most fds passed with one message
+#define REQUEST_MAX_FDS 32
+
+bool requestAppendString(char *buffer, size_t *length, const char *value);
+
+char *requestTakeString(char **cursor, const char *end);
+
+ssize_t requestSend(int socket, const void *data, size_t length, const int *fds, int fdCount);
+
+ssize_t requestReceive(int socket, void *data, size_t size, int fds[REQUEST_MAX_FDS], int *fdCount);
+
+#endif
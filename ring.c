@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "ring.h"
+
+/**
+ * Lock-free single producer, single consumer byte ring, connecting two in-process pipeline stages running
+ * on different threads. Head and tail only ever grow (wrapping), the producer owns tail and the consumer head.
+ * A side only sleeps on a futex when the ring stays full or empty after spinning, so a busy pipeline moves
+ * data without system calls.
+ */
+
+#define SPIN_LIMIT 128
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() ((void) 0)
+#endif
+
+/**
+ * Sleep until *word changes from value, or a wake up
+ * @param word word to wait on
+ * @param value value the word had
+ */
+static void futexWait(uint32_t *word, uint32_t value) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+/**
+ * Wake the thread sleeping on word
+ * @param word word waited on
+ */
+static void futexWake(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Wait until the other side moves word away from value, or sets stop
+ * @param word counter owned by the other side
+ * @param value value the counter had
+ * @param waiting this side's waiting flag
+ * @param stop flag ending the wait, e.g. closed
+ */
+static void ringWait(uint32_t *word, uint32_t value, uint32_t *waiting, const uint32_t *stop) {
+    for (int i = 0; i < SPIN_LIMIT; ++i) {
+        if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != value || __atomic_load_n(stop, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+        CPU_RELAX();
+    }
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    // The other side checks the flag after moving its counter, so looking again here cannot miss a wake up
+    if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == value && !__atomic_load_n(stop, __ATOMIC_SEQ_CST)) {
+        futexWait(word, value);
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * Wake the other side if it is asleep
+ * @param word counter just moved
+ * @param waiting the other side's waiting flag
+ */
+static void ringNotify(uint32_t *word, uint32_t *waiting) {
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+        futexWake(word);
+    }
+}
+
+/**
+ * Prepare an empty ring
+ * @param ring ring to initialise
+ */
+void ringInit(spscRing *ring) {
+    ring->tail = 0;
+    ring->producerWaiting = 0;
+    ring->closed = 0;
+    ring->head = 0;
+    ring->consumerWaiting = 0;
+    ring->abandoned = 0;
+}
+
+/**
+ * Write all of buffer into the ring, waiting for space, producer only
+ * @param ring ring to write to
+ * @param buffer bytes to write
+ * @param size amount of bytes
+ * @return false if the consumer has gone away, like EPIPE
+ */
+bool ringWrite(spscRing *ring, const void *buffer, size_t size) {
+    const char *bytes = buffer;
+    const uint32_t tail = ring->tail;
+    uint32_t written = 0;
+    while (size > 0) {
+        if (__atomic_load_n(&ring->abandoned, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        const uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        const uint32_t position = tail + written;
+        const uint32_t space = RING_SIZE - (position - head);
+        if (space == 0) {
+            // Publish what was written so far before sleeping
+            __atomic_store_n(&ring->tail, position, __ATOMIC_SEQ_CST);
+            ringNotify(&ring->tail, &ring->consumerWaiting);
+            ringWait(&ring->head, head, &ring->producerWaiting, &ring->abandoned);
+            continue;
+        }
+        const uint32_t offset = position & (RING_SIZE - 1);
+        uint32_t chunk = space < size ? space : (uint32_t) size;
+        chunk = chunk < RING_SIZE - offset ? chunk : RING_SIZE - offset;
+        memcpy(ring->data + offset, bytes, chunk);
+        bytes += chunk;
+        size -= chunk;
+        written += chunk;
+    }
+    __atomic_store_n(&ring->tail, tail + written, __ATOMIC_SEQ_CST);
+    ringNotify(&ring->tail, &ring->consumerWaiting);
+    return true;
+}
+
+/**
+ * Mark the end of the data, producer only
+ * @param ring ring to close
+ */
+void ringClose(spscRing *ring) {
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+    // The consumer may be asleep on tail
+    futexWake(&ring->tail);
+}
+
+/**
+ * Read up to size bytes, waiting for data, consumer only
+ * @param ring ring to read from
+ * @param buffer buffer to be populated
+ * @param size size of the buffer
+ * @return amount of bytes read, 0 once the ring is closed and empty
+ */
+ssize_t ringRead(spscRing *ring, void *buffer, size_t size) {
+    const uint32_t head = ring->head;
+    while (1) {
+        const uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (tail != head) {
+            const uint32_t offset = head & (RING_SIZE - 1);
+            uint32_t chunk = tail - head < size ? tail - head : (uint32_t) size;
+            chunk = chunk < RING_SIZE - offset ? chunk : RING_SIZE - offset;
+            memcpy(buffer, ring->data + offset, chunk);
+            __atomic_store_n(&ring->head, head + chunk, __ATOMIC_SEQ_CST);
+            ringNotify(&ring->head, &ring->producerWaiting);
+            return chunk;
+        }
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) {
+            // Data written just before closing is visible by now
+            if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head) {
+                return 0;
+            }
+            continue;
+        }
+        ringWait(&ring->tail, tail, &ring->consumerWaiting, &ring->closed);
+    }
+}
+
+/**
+ * Stop consuming, the producer's writes fail from now on, consumer only
+ * @param ring ring to abandon
+ */
+void ringAbandon(spscRing *ring) {
+    __atomic_store_n(&ring->abandoned, 1, __ATOMIC_SEQ_CST);
+    futexWake(&ring->head);
+}
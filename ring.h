@@ -0,0 +1,33 @@
+#ifndef ASSIGNMENT1_RING_H
+#define ASSIGNMENT1_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Capacity of a ring in bytes, a power of two
+#define RING_SIZE (1 << 16)
+
+typedef struct spscRing {
+    // Written by the producer only, padded so producer and consumer do not share a cache line
+    uint32_t tail __attribute__((aligned(64)));
+    uint32_t producerWaiting;
+    uint32_t closed;
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t consumerWaiting;
+    uint32_t abandoned;
+    char data[RING_SIZE] __attribute__((aligned(64)));
+} spscRing;
+
+void ringInit(spscRing *ring);
+
+bool ringWrite(spscRing *ring, const void *buffer, size_t size);
+
+void ringClose(spscRing *ring);
+
+ssize_t ringRead(spscRing *ring, void *buffer, size_t size);
+
+void ringAbandon(spscRing *ring);
+
+#endif
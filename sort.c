@@ -0,0 +1,537 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sort.h"
+
+/**
+ * The sort stream builtin, sorting lines bytewise (like LC_ALL=C sort). It only takes over sort under a C or POSIX
+ * collation locale, any other locale runs the system sort.
+ * Lines are read into one buffer and indexed by offset with the first 8 bytes as a big-endian key. Every chunk
+ * is split between the cpus, each thread radix sorts its part on the key and sorts lines with equal keys by
+ * comparison, then the parts are merged into the output. When the input does not fit the memory budget, each
+ * sorted chunk is spilled to an unlinked temporary file and all of them are merged at the end.
+ */
+
+#define SORT_DEFAULT_BUDGET (256UL << 20)
+#define SORT_MIN_BUDGET (1UL << 20)
+#define SORT_READ_SIZE STREAM_BUFFER_SIZE
+// Smallest part worth a thread of its own
+#define SORT_THREAD_LINES 16384
+#define SORT_MAX_THREADS 64
+
+typedef struct sortLine {
+    uint64_t key;
+    size_t offset;
+    size_t length;
+} sortLine;
+
+typedef struct sorter {
+    // Input read so far, lines are kept as offsets since the buffer moves when it grows
+    char *data;
+    size_t used;
+    size_t capacity;
+    // Start of the line not ended by a newline yet
+    size_t lineStart;
+    sortLine *lines;
+    size_t count;
+    size_t lineCapacity;
+    size_t budget;
+    bool reverse;
+    // Spilled runs, unlinked temporary files
+    int *runs;
+    size_t runCount;
+} sorter;
+
+typedef struct sortOrder {
+    const char *base;
+    bool reverse;
+} sortOrder;
+
+typedef struct sortTask {
+    const sortOrder *order;
+    sortLine *lines;
+    sortLine *scratch;
+    size_t count;
+} sortTask;
+
+typedef struct mergeSource {
+    // Current line of the source
+    const char *text;
+    size_t length;
+    // Sorted part of a chunk in memory
+    const sortLine *next;
+    const sortLine *last;
+    const char *base;
+    // Sorted run in a file, -1 for a chunk in memory
+    int fd;
+    char *buffer;
+    size_t start;
+    size_t filled;
+    size_t capacity;
+} mergeSource;
+
+/**
+ * @param text line
+ * @param length length of the line
+ * @return the first 8 bytes of the line as a big-endian number, padded with zeros
+ */
+static uint64_t lineKey(const char *text, size_t length) {
+    uint64_t key = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        key = key << 8 | (i < length ? (unsigned char) text[i] : 0);
+    }
+    return key;
+}
+
+/**
+ * Compare two lines bytewise, a line sorts before the lines it is a prefix of
+ * @return negative, zero or positive like memcmp
+ */
+static int compareLines(const char *a, size_t aLength, const char *b, size_t bLength) {
+    const int result = memcmp(a, b, aLength < bLength ? aLength : bLength);
+    return result != 0 ? result : (aLength > bLength) - (aLength < bLength);
+}
+
+/**
+ * Compare two indexed lines, for qsort_r
+ * @param a first line
+ * @param b second line
+ * @param context the sortOrder
+ * @return negative, zero or positive like memcmp
+ */
+static int compareSortLines(const void *a, const void *b, void *context) {
+    const sortLine *const x = a;
+    const sortLine *const y = b;
+    const sortOrder *const order = context;
+    if (x->key != y->key) {
+        // Keys are inverted when sorting in reverse
+        return x->key < y->key ? -1 : 1;
+    }
+    const int result = compareLines(order->base + x->offset, x->length, order->base + y->offset, y->length);
+    return order->reverse ? -result : result;
+}
+
+/**
+ * Sort a part of a chunk, LSD radix sort on the keys then a comparison sort of every group of equal keys
+ * @param context the sortTask
+ * @return NULL
+ */
+static void *sortPart(void *context) {
+    const sortTask *const task = context;
+    sortLine *from = task->lines;
+    sortLine *to = task->scratch;
+    if (task->count < 2) {
+        return NULL;
+    }
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t counts[256] = {0};
+        for (size_t i = 0; i < task->count; ++i) {
+            ++counts[from[i].key >> shift & 0xff];
+        }
+        // Skip the bytes all keys share, e.g. the padding of short lines
+        if (counts[from[0].key >> shift & 0xff] == task->count) {
+            continue;
+        }
+        size_t position = 0;
+        for (int i = 0; i < 256; ++i) {
+            const size_t n = counts[i];
+            counts[i] = position;
+            position += n;
+        }
+        for (size_t i = 0; i < task->count; ++i) {
+            to[counts[from[i].key >> shift & 0xff]++] = from[i];
+        }
+        sortLine *const swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != task->lines) {
+        memcpy(task->lines, from, sizeof(sortLine) * task->count);
+    }
+
+    for (size_t i = 0; i < task->count;) {
+        size_t j = i + 1;
+        bool same = task->lines[i].length <= 8;
+        for (; j < task->count && task->lines[j].key == task->lines[i].key; ++j) {
+            same = same && task->lines[j].length == task->lines[i].length;
+        }
+        // Short lines of the same length with equal keys are equal
+        if (j - i > 1 && !same) {
+            qsort_r(task->lines + i, j - i, sizeof(sortLine), compareSortLines, (void *) task->order);
+        }
+        i = j;
+    }
+    return NULL;
+}
+
+/**
+ * Sort the chunk in memory in parallel, leaving sorted parts to be merged
+ * @param s the sorter
+ * @param order order of the lines
+ * @param sources populated with one source per sorted part
+ * @return amount of parts
+ */
+static size_t sortChunk(const sorter *s, const sortOrder *order, mergeSource sources[SORT_MAX_THREADS]) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t parts = s->count / SORT_THREAD_LINES;
+    parts = parts < (size_t) cpus ? parts : (size_t) cpus;
+    parts = parts < SORT_MAX_THREADS ? parts : SORT_MAX_THREADS;
+    parts = parts > 0 ? parts : 1;
+
+    sortLine *const scratch = malloc(sizeof(sortLine) * (s->count > 0 ? s->count : 1));
+    sortTask tasks[SORT_MAX_THREADS];
+    pthread_t threads[SORT_MAX_THREADS];
+    bool started[SORT_MAX_THREADS] = {false};
+    for (size_t i = 0; i < parts; ++i) {
+        const size_t first = s->count * i / parts;
+        const size_t last = s->count * (i + 1) / parts;
+        tasks[i] = (sortTask) {order, s->lines + first, scratch + first, last - first};
+        sources[i] = (mergeSource) {.next = s->lines + first, .last = s->lines + last, .base = s->data, .fd = -1};
+        // The calling thread sorts the first part itself
+        started[i] = i > 0 && pthread_create(&threads[i], NULL, sortPart, &tasks[i]) == 0;
+    }
+    for (size_t i = 0; i < parts; ++i) {
+        if (!started[i]) {
+            sortPart(&tasks[i]);
+        }
+    }
+    for (size_t i = 0; i < parts; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    free(scratch);
+    return parts;
+}
+
+/**
+ * Move a merge source to its next line
+ * @param source source to advance
+ * @return false at the end of the source
+ */
+static bool advanceSource(mergeSource *source) {
+    if (source->fd < 0) {
+        if (source->next == source->last) {
+            return false;
+        }
+        source->text = source->base + source->next->offset;
+        source->length = source->next->length;
+        ++source->next;
+        return true;
+    }
+    while (true) {
+        char *const newline = memchr(source->buffer + source->start, '\n', source->filled - source->start);
+        if (newline != NULL) {
+            source->text = source->buffer + source->start;
+            source->length = (size_t) (newline - source->text);
+            source->start += source->length + 1;
+            return true;
+        }
+        memmove(source->buffer, source->buffer + source->start, source->filled - source->start);
+        source->filled -= source->start;
+        source->start = 0;
+        if (source->filled == source->capacity) {
+            source->capacity *= 2;
+            source->buffer = realloc(source->buffer, source->capacity);
+        }
+        ssize_t n;
+        while ((n = read(source->fd, source->buffer + source->filled, source->capacity - source->filled)) < 0 &&
+               errno == EINTR);
+        if (n <= 0) {
+            // Runs always end with a newline
+            if (n < 0) {
+                perror("sort: temporary file");
+            }
+            return false;
+        }
+        source->filled += (size_t) n;
+    }
+}
+
+/**
+ * @return true if the current line of a should come out before that of b
+ */
+static bool sourceBefore(const mergeSource *a, const mergeSource *b, bool reverse) {
+    const int result = compareLines(a->text, a->length, b->text, b->length);
+    return reverse ? result > 0 : result < 0;
+}
+
+/**
+ * Restore the heap order below a node
+ * @param heap heap of sources, the first comes out next
+ * @param size amount of sources in the heap
+ * @param i node to move down
+ * @param reverse whether the lines are sorted in reverse
+ */
+static void siftDown(mergeSource **heap, size_t size, size_t i, bool reverse) {
+    while (true) {
+        size_t smallest = i;
+        for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < size; ++child) {
+            if (sourceBefore(heap[child], heap[smallest], reverse)) {
+                smallest = child;
+            }
+        }
+        if (smallest == i) {
+            return;
+        }
+        mergeSource *const swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+/**
+ * Merge sorted sources into an output
+ * @param out stream to write the lines to
+ * @param sources sorted sources
+ * @param count amount of sources
+ * @param reverse whether the lines are sorted in reverse
+ * @return false if the output has failed
+ */
+static bool mergeSources(stream *out, mergeSource sources[], size_t count, bool reverse) {
+    mergeSource **const heap = malloc(sizeof(mergeSource *) * (count > 0 ? count : 1));
+    size_t size = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (advanceSource(&sources[i])) {
+            heap[size++] = &sources[i];
+        }
+    }
+    for (size_t i = size / 2; i-- > 0;) {
+        siftDown(heap, size, i, reverse);
+    }
+    while (size > 0 && !out->failed) {
+        streamWrite(out, heap[0]->text, heap[0]->length);
+        streamWrite(out, "\n", 1);
+        if (!advanceSource(heap[0])) {
+            heap[0] = heap[--size];
+        }
+        siftDown(heap, size, 0, reverse);
+    }
+    free(heap);
+    return !out->failed;
+}
+
+/**
+ * Sort the chunk in memory and write it to a new run, keeping the unfinished line
+ * @param s the sorter
+ * @return false if the run could not be written
+ */
+static bool spill(sorter *s) {
+    const int fd = streamTemporary("sort");
+    if (fd < 0) {
+        fprintf(stderr, "sort: cannot create temporary file: %s\n", strerror(errno));
+        return false;
+    }
+
+    const sortOrder order = {s->data, s->reverse};
+    mergeSource sources[SORT_MAX_THREADS];
+    const size_t parts = sortChunk(s, &order, sources);
+    stream run;
+    streamFromFd(&run, fd);
+    mergeSources(&run, sources, parts, s->reverse);
+    streamFinish(&run);
+    if (run.failed) {
+        fprintf(stderr, "sort: cannot write temporary file: %s\n", strerror(errno));
+        close(fd);
+        return false;
+    }
+    s->runs = realloc(s->runs, sizeof(int) * (s->runCount + 1));
+    s->runs[s->runCount++] = fd;
+
+    memmove(s->data, s->data + s->lineStart, s->used - s->lineStart);
+    s->used -= s->lineStart;
+    s->lineStart = 0;
+    s->count = 0;
+    return true;
+}
+
+/**
+ * Index a line of the input
+ * @param s the sorter
+ * @param offset start of the line in the buffer
+ * @param length length of the line, without its newline
+ */
+static void addLine(sorter *s, size_t offset, size_t length) {
+    if (s->count == s->lineCapacity) {
+        s->lineCapacity = s->lineCapacity > 0 ? s->lineCapacity * 2 : 1024;
+        s->lines = realloc(s->lines, sizeof(sortLine) * s->lineCapacity);
+    }
+    const uint64_t key = lineKey(s->data + offset, length);
+    s->lines[s->count++] = (sortLine) {s->reverse ? ~key : key, offset, length};
+}
+
+/**
+ * Read one input of sort into the sorter
+ * @param source input to read
+ * @param name name of the input, for errors
+ * @param context the sorter
+ * @return false if the input could not be read or a run could not be spilled
+ */
+static bool sortInput(stream *source, const char *name, void *context) {
+    sorter *const s = context;
+    while (true) {
+        if (s->capacity - s->used < SORT_READ_SIZE) {
+            s->capacity = s->capacity * 2 > s->used + SORT_READ_SIZE ? s->capacity * 2 : s->used + SORT_READ_SIZE;
+            s->data = realloc(s->data, s->capacity);
+        }
+        const ssize_t n = streamRead(source, s->data + s->used, SORT_READ_SIZE);
+        if (n < 0) {
+            fprintf(stderr, "sort: %s: %s\n", name, strerror(errno));
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        // Only the new bytes can hold newlines
+        const char *search = s->data + s->used;
+        s->used += (size_t) n;
+        const char *newline;
+        while ((newline = memchr(search, '\n', (size_t) (s->data + s->used - search))) != NULL) {
+            addLine(s, s->lineStart, (size_t) (newline - s->data) - s->lineStart);
+            s->lineStart = (size_t) (newline - s->data) + 1;
+            search = newline + 1;
+        }
+        // The lines and the scratch space of the radix sort
+        const size_t memory = s->used + 2 * sizeof(sortLine) * s->count;
+        if (memory > s->budget && s->count > 0 && !spill(s)) {
+            return false;
+        }
+    }
+    // A last line without a newline
+    if (s->lineStart < s->used) {
+        addLine(s, s->lineStart, s->used - s->lineStart);
+        s->lineStart = s->used;
+    }
+    return true;
+}
+
+/**
+ * Parse a memory size such as 512K, 64M or 2G
+ * @param text size to parse
+ * @param size populated with the size in bytes
+ * @return false if it is not a valid size
+ */
+static bool parseSize(const char *text, size_t *size) {
+    char *end;
+    errno = 0;
+    const unsigned long long value = strtoull(text, &end, 10);
+    unsigned int shift = 0;
+    switch (*end) {
+        case 'K':
+        case 'k':
+            shift = 10;
+            break;
+        case 'M':
+        case 'm':
+            shift = 20;
+            break;
+        case 'G':
+        case 'g':
+            shift = 30;
+            break;
+        case '\0':
+            break;
+        default:
+            return false;
+    }
+    if (end == text || errno != 0 || (shift > 0 && end[1] != '\0') || value > (SIZE_MAX >> shift)) {
+        return false;
+    }
+    *size = (size_t) value << shift;
+    return true;
+}
+
+/**
+ * @return true if commands collate under the C or POSIX locale, where the system sort orders lines bytewise
+ */
+bool sortCollatesBytewise(void) {
+    // The first of these that is set and not empty decides the collation, like for any other program
+    static const char *const variables[] = {"LC_ALL", "LC_COLLATE", "LANG"};
+    const char *locale = NULL;
+    for (size_t i = 0; i < sizeof(variables) / sizeof(*variables) && (locale == NULL || *locale == '\0'); ++i) {
+        locale = getenv(variables[i]);
+    }
+    return locale == NULL || *locale == '\0' || strcmp(locale, "C") == 0 || strcmp(locale, "POSIX") == 0;
+}
+
+/**
+ * @param params arguments of a sort command, with no other options than -r and -S
+ * @return true if the builtin sorts like the system sort would, false if the system sort has to run it
+ */
+bool sortImplements(char *params[]) {
+    if (!sortCollatesBytewise()) {
+        return false;
+    }
+    for (; *params != NULL && **params == '-' && (*params)[1] != '\0'; ++params) {
+        if (strncmp(*params, "-S", 2) == 0) {
+            // Sizes such as 50% or 1T are left to the system sort
+            const char *const size = (*params)[2] != '\0' ? *params + 2 : *++params;
+            size_t budget;
+            if (size == NULL || !parseSize(size, &budget)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Executes the sort command
+ * @param params -r to sort in reverse, -S size for the memory budget before spilling to temporary files,
+ * then files to sort, - or none for the input
+ * @param in input of the command
+ * @param out output of the command
+ * @return exit status
+ */
+int sort(char *params[], stream *in, stream *out) {
+    sorter s = {.budget = SORT_DEFAULT_BUDGET};
+    for (; *params != NULL && **params == '-' && (*params)[1] != '\0'; ++params) {
+        if (strcmp(*params, "-r") == 0) {
+            s.reverse = true;
+        } else if (strncmp(*params, "-S", 2) == 0) {
+            const char *const size = (*params)[2] != '\0' ? *params + 2 : *++params;
+            if (size == NULL || !parseSize(size, &s.budget)) {
+                fprintf(stderr, "sort: invalid buffer size %s\n", size != NULL ? size : "");
+                return 2;
+            }
+            s.budget = s.budget > SORT_MIN_BUDGET ? s.budget : SORT_MIN_BUDGET;
+        } else {
+            fprintf(stderr, "sort: invalid option %s\n", *params);
+            return 2;
+        }
+    }
+
+    int status = streamEachInput("sort", params, in, out, sortInput, &s);
+    if (s.runCount > 0 && s.count > 0 && !spill(&s)) {
+        status = 2;
+    }
+    if (s.runCount > 0) {
+        mergeSource *const sources = calloc(s.runCount, sizeof(mergeSource));
+        for (size_t i = 0; i < s.runCount; ++i) {
+            lseek(s.runs[i], 0, SEEK_SET);
+            sources[i] = (mergeSource) {.fd = s.runs[i], .buffer = malloc(SORT_READ_SIZE),
+                                        .capacity = SORT_READ_SIZE};
+        }
+        mergeSources(out, sources, s.runCount, s.reverse);
+        for (size_t i = 0; i < s.runCount; ++i) {
+            free(sources[i].buffer);
+            close(s.runs[i]);
+        }
+        free(sources);
+    } else {
+        const sortOrder order = {s.data, s.reverse};
+        mergeSource sources[SORT_MAX_THREADS];
+        const size_t parts = sortChunk(&s, &order, sources);
+        mergeSources(out, sources, parts, s.reverse);
+    }
+    free(s.runs);
+    free(s.lines);
+    free(s.data);
+    return status;
+}
@@ -0,0 +1,13 @@
+#ifndef ASSIGNMENT1_SORT_H
+#define ASSIGNMENT1_SORT_H
+
+#include <stdbool.h>
+#include "stream.h"
+
+bool sortCollatesBytewise(void);
+
+bool sortImplements(char *params[]);
+
+int sort(char *params[], stream *in, stream *out);
+
+#endif
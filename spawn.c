@@ -0,0 +1,322 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/fcntl.h>
+#include <sys/wait.h>
+#include "spawn.h"
+#include "stats.h"
+#include "trace.h"
+#include "jobs.h"
+#include "workerpool.h"
+#include "zygote.h"
+#include "stream.h"
+
+// Room left for the kernel's own use of the argument area, like xargs
+#define ARG_HEADROOM 2048
+#define COPROC_MAX_FDS 64
+
+// Whether commands too long for execve are split into batches, the split-args option
+splitMode splitArgs = SPLIT_OFF;
+
+// Set while the shell's stdin is moved onto a file for a rewritten pipeline
+bool inputMoved = false;
+
+// Set while stdout and stderr are moved for a command started by spawnCommandWithOutput
+static bool outputMoved = false;
+
+extern char **environ;
+
+/**
+ * @param arg an argument or environment variable
+ * @return space it takes in the argument area of a new program
+ */
+static size_t argSize(const char *arg) {
+    return strlen(arg) + 1 + sizeof(char *);
+}
+
+/**
+ * @return space the arguments of a new program can take, next to the environment
+ */
+static size_t argLimit(void) {
+    size_t environment = sizeof(char *);
+    for (char **variable = environ; *variable != NULL; ++variable) {
+        environment += argSize(*variable);
+    }
+    const size_t limit = (size_t) sysconf(_SC_ARG_MAX);
+    return limit > environment + ARG_HEADROOM ? limit - environment - ARG_HEADROOM : 0;
+}
+
+/**
+ * @param args command (tokenized)
+ * @return true if the command fits in the argument area, i.e. execve will not fail with E2BIG
+ */
+static bool argsFit(char *args[]) {
+    size_t size = sizeof(char *);
+    for (; *args != NULL; ++args) {
+        size += argSize(*args);
+    }
+    return size <= argLimit();
+}
+
+/**
+ * Run a command too long for execve as several commands, like xargs. The command and its leading options are
+ * repeated in every batch, the arguments after them are split into batches as large as fit.
+ * @param args command (tokenized)
+ */
+static void runSplit(char *args[]) {
+    int fixed = 1;
+    while (args[fixed] != NULL && *args[fixed] == '-') {
+        ++fixed;
+    }
+    int count = fixed;
+    while (args[count] != NULL) {
+        ++count;
+    }
+    const size_t limit = argLimit();
+    size_t base = sizeof(char *);
+    for (int i = 0; i < fixed; ++i) {
+        base += argSize(args[i]);
+    }
+
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const int slots = splitArgs == SPLIT_PARALLEL && cpus > 1 ? (int) cpus : 1;
+    pid_t *const running = malloc(sizeof(pid_t) * (size_t) slots);
+    char **const batch = malloc(sizeof(char *) * ((size_t) count + 1));
+    memcpy(batch, args, sizeof(char *) * (size_t) fixed);
+    int result = 0;
+    int started = 0;
+    for (int next = fixed; next < count || started == 0;) {
+        // Every batch takes at least one argument, one that is too long on its own fails in execvp
+        int length = fixed;
+        for (size_t size = base; next < count && (length == fixed || size + argSize(args[next]) <= limit); ++next) {
+            size += argSize(args[next]);
+            batch[length++] = args[next];
+        }
+        batch[length] = NULL;
+
+        // Batches run in order, at most one per cpu at once in parallel mode
+        if (started >= slots) {
+            int status;
+            waitpid(running[started % slots], &status, 0);
+            result = result != 0 ? result : WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        }
+        fflush(stdout);
+        const pid_t pid = fork();
+        if (pid == 0) {
+            execvp(*batch, batch);
+            fprintf(stderr, "%s: %s\n", *batch, strerror(errno));
+            _exit(errno == E2BIG ? 126 : 127);
+        }
+        running[started++ % slots] = pid;
+    }
+    for (int i = started > slots ? started - slots : 0; i < started; ++i) {
+        int status;
+        waitpid(running[i % slots], &status, 0);
+        result = result != 0 ? result : WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+    exit(result);
+}
+
+/**
+ * Run the given command
+ * @param args command
+ * @param outputRedirection where the output should be redirected, if NULL no redirection will take place
+ */
+void runCmd(char *args[], const char *const outputRedirection) {
+    if (outputRedirection != NULL) {
+        fflush(stdout);
+        const int output = open(outputRedirection, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (output < 0) {
+            perror("error opening file");
+            exit(127);
+        }
+
+        if (dup2(output, fileno(stdout)) < 0) {
+            perror("error redirecting stdout");
+            exit(127);
+        }
+    }
+
+    if (isStreamBuiltin(args)) {
+        exit(runStreamBuiltin(args));
+    }
+    // The coprocess ends the command names stay open in it, every other one is closed on exec
+    int coprocFds[COPROC_MAX_FDS];
+    const int used = coprocFdsUsed(args, NULL, coprocFds, COPROC_MAX_FDS);
+    for (int i = 0; i < used && i < COPROC_MAX_FDS; ++i) {
+        fcntl(coprocFds[i], F_SETFD, 0);
+    }
+    if (splitArgs != SPLIT_OFF && !argsFit(args)) {
+        runSplit(args);
+    }
+    execvp(*args, args);
+    if (errno == E2BIG) {
+        fprintf(stderr, "%s: argument list too long, set -o split-args runs it in batches\n", *args);
+        exit(126);
+    }
+    printf("Failed to execute command\n");
+    exit(127);
+}
+
+/**
+ * Run a command, or two commands connected by a pipe, in the current (child) process
+ * @param args command/s (tokenized)
+ * @param outputRedirection where the output should be redirected, if NULL no redirection will take place
+ * @param cmdPipeIndex the next index after where the pipe was found, if -1 then no command piping will take place
+ */
+void runPipeline(char *args[], const char *const outputRedirection, int cmdPipeIndex) {
+    if (cmdPipeIndex > 0) {
+        int fileDescriptors[2];
+        pipe(fileDescriptors);
+        if (fork() == 0) { // This is the child
+            dup2(fileDescriptors[1], fileno(stdout));
+            runCmd(args, outputRedirection);
+        }
+
+        // This is the parent
+        dup2(fileDescriptors[0], fileno(stdin));
+        close(fileDescriptors[1]); // Close write end of pipe
+        runCmd(args + cmdPipeIndex, outputRedirection); // Start the commands to the right of the pipe
+    }
+    runCmd(args, outputRedirection);
+}
+
+/**
+ * Start a command, or two commands connected by a pipe, in a child process
+ * @param args command/s (tokenized)
+ * @param outputRedirection where the output should be redirected, if NULL no redirection will take place
+ * @param cmdPipeIndex the next index after where the pipe was found, if -1 then no command piping will take place
+ * @param niceness nice increment for the child, relative to the shell
+ * @param pidfd pointer to be populated with a pidfd of the child, -1 if there is none, may be NULL
+ * @return pid of the child, -1 if it could not be forked
+ */
+pid_t spawnCommand(char *args[], const char *const outputRedirection, int cmdPipeIndex, int niceness, int *pidfd) {
+    if (pidfd != NULL) {
+        *pidfd = -1;
+    }
+    // Only a child of the shell knows to split a command too long for execve
+    const bool split = splitArgs != SPLIT_OFF &&
+                       (!argsFit(args) || (cmdPipeIndex > 0 && !argsFit(args + cmdPipeIndex)));
+    // Workers exec, so they cannot run stream builtins, and keep the stdin and stdout they were forked with
+    if (cmdPipeIndex <= 0 && workerPoolSize() > 0 && coprocFdsUsed(args, outputRedirection, NULL, 0) == 0 &&
+        !isStreamBuiltin(args) &&
+        !inputMoved && !outputMoved && !split) {
+        const uint64_t handoffStart = traceNow();
+        const pid_t workerPID = workerPoolSpawn(args, outputRedirection, niceness);
+        if (workerPID > 0) {
+            STAT_ADD(poolSpawns, 1);
+            traceRecord(TRACE_FORK, handoffStart, 0, *args);
+            return workerPID;
+        }
+    }
+    if (zygoteActive() && !split) {
+        const uint64_t handoffStart = traceNow();
+        const pid_t zygotePID = zygoteSpawn(args, outputRedirection, cmdPipeIndex, niceness, pidfd);
+        if (zygotePID > 0) {
+            STAT_ADD(forks, cmdPipeIndex > 0 ? 2 : 1);
+            STAT_ADD(pipes, cmdPipeIndex > 0);
+            STAT_ADD(zygoteSpawns, 1);
+            traceRecord(TRACE_FORK, handoffStart, 0, *args);
+            return zygotePID;
+        }
+    }
+
+    // The child forks again for the left side of a pipe
+    STAT_ADD(forks, cmdPipeIndex > 0 ? 2 : 1);
+    STAT_ADD(pipes, cmdPipeIndex > 0);
+    const uint64_t forkStart = traceNow();
+    const pid_t childPID = fork();
+    if (childPID) {
+        traceRecord(TRACE_FORK, forkStart, 0, *args);
+        return childPID;
+    }
+
+    if (niceness != 0) {
+        nice(niceness);
+    }
+    runPipeline(args, outputRedirection, cmdPipeIndex);
+    return 0;
+}
+
+/**
+ * Start a command like spawnCommand, with its stdout and stderr connected to another fd
+ * @param args command/s (tokenized)
+ * @param outputRedirection where the output should be redirected, if NULL no redirection will take place
+ * @param cmdPipeIndex the next index after where the pipe was found, if -1 then no command piping will take place
+ * @param niceness nice increment for the child, relative to the shell
+ * @param pidfd pointer to be populated with a pidfd of the child, -1 if there is none, may be NULL
+ * @param output fd the child's stdout and stderr are connected to
+ * @return pid of the child, -1 if it could not be forked
+ */
+pid_t spawnCommandWithOutput(char *args[], const char *const outputRedirection, int cmdPipeIndex, int niceness,
+                             int *pidfd, int output) {
+    const int savedOutput = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+    const int savedError = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+    if (savedOutput < 0 || savedError < 0) {
+        close(savedOutput);
+        close(savedError);
+        return -1;
+    }
+    // The shell's own buffered output belongs on the terminal
+    fflush(stdout);
+    dup2(output, STDOUT_FILENO);
+    dup2(output, STDERR_FILENO);
+    outputMoved = true;
+    const pid_t childPID = spawnCommand(args, outputRedirection, cmdPipeIndex, niceness, pidfd);
+    const int savedErrno = errno;
+    outputMoved = false;
+    dup2(savedOutput, STDOUT_FILENO);
+    dup2(savedError, STDERR_FILENO);
+    close(savedOutput);
+    close(savedError);
+    errno = savedErrno;
+    return childPID;
+}
+
+/**
+ * Start a command as a coprocess, with its stdin and stdout connected to the shell by pipes
+ * @param args command/s (tokenized)
+ * @param cmdPipeIndex the next index after where the pipe was found, if -1 then no command piping will take place
+ * @param fds array to be populated with the shell's ends, [0] reads the coprocess's output, [1] writes its input
+ * @return pid of the child, -1 if the pipes could not be created or the child forked
+ */
+pid_t spawnCoprocess(char *args[], int cmdPipeIndex, int fds[2]) {
+    // Every end is close-on-exec, the child's ends lose it when they are moved onto stdin and stdout. The shell's
+    // ends keep it, runCmd only lets the commands that name them inherit them.
+    int input[2];
+    int output[2];
+    if (pipe2(input, O_CLOEXEC)) {
+        return -1;
+    }
+    if (pipe2(output, O_CLOEXEC)) {
+        close(input[0]);
+        close(input[1]);
+        return -1;
+    }
+
+    STAT_ADD(forks, cmdPipeIndex > 0 ? 2 : 1);
+    STAT_ADD(pipes, cmdPipeIndex > 0);
+    const uint64_t forkStart = traceNow();
+    const pid_t childPID = fork();
+    if (childPID == 0) {
+        dup2(input[0], fileno(stdin));
+        dup2(output[1], fileno(stdout));
+        runPipeline(args, NULL, cmdPipeIndex);
+    }
+
+    close(input[0]);
+    close(output[1]);
+    if (childPID < 0) {
+        close(input[1]);
+        close(output[0]);
+        return -1;
+    }
+    traceRecord(TRACE_FORK, forkStart, 0, *args);
+    fds[0] = output[0];
+    fds[1] = input[1];
+    return childPID;
+}
@@ -0,0 +1,29 @@
+#ifndef ASSIGNMENT1_SPAWN_H
+#define ASSIGNMENT1_SPAWN_H
+
+#include <sys/types.h>
+
+typedef enum splitMode {
+    SPLIT_OFF,
+    SPLIT_SEQUENTIAL,
+    SPLIT_PARALLEL,
+} splitMode;
+
+// Whether commands too long for execve are split into batches, the split-args option
+extern splitMode splitArgs;
+
+// Set while the shell's stdin is moved onto a file for a rewritten pipeline
+extern bool inputMoved;
+
+void runCmd(char *args[], const char *outputRedirection);
+
+pid_t spawnCommand(char *args[], const char *outputRedirection, int cmdPipeIndex, int niceness, int *pidfd);
+
+pid_t spawnCommandWithOutput(char *args[], const char *outputRedirection, int cmdPipeIndex, int niceness,
+                             int *pidfd, int output);
+
+void runPipeline(char *args[], const char *outputRedirection, int cmdPipeIndex);
+
+pid_t spawnCoprocess(char *args[], int cmdPipeIndex, int fds[2]);
+
+#endif
@@ -0,0 +1,53 @@
+#include <time.h>
+#include "stats.h"
+
+/**
+ * Counters describing what the shell has done since it started
+ */
+
+shellStats stats;
+
+const statDescription statDescriptions[] = {
+        {"commands_total",      "Commands executed",                        &stats.commands,     1},
+        {"builtins_total",      "Commands run as builtins",                 &stats.builtins,     1},
+        {"externals_total",     "Commands run as external programs",        &stats.externals,    1},
+        {"forks_total",         "Processes forked",                         &stats.forks,        1},
+        {"pool_spawns_total",   "Commands started by a prefork worker",     &stats.poolSpawns,   1},
+        {"zygote_spawns_total", "Commands started by the zygote",           &stats.zygoteSpawns, 1},
+        {"exec_failures_total", "Commands that could not be executed",      &stats.execFailures, 1},
+        {"pipes_total",         "Pipes created",                            &stats.pipes,        1},
+        {"jobs_queued_total",   "Background jobs queued for a job slot",    &stats.jobsQueued,   1},
+        {"jobs_launched_total", "Background jobs launched",                 &stats.jobsLaunched, 1},
+        {"jobs_reaped_total",   "Background jobs reaped",                   &stats.jobsReaped,   1},
+        {"builtin_bytes_total", "Bytes written by builtins",                &stats.builtinBytes, 1},
+        {"wait_seconds_total",  "Time spent waiting for children, seconds", &stats.waitNs,       1e-9},
+};
+const size_t statCount = sizeof(statDescriptions) / sizeof(*statDescriptions);
+
+/**
+ * Current monotonic time
+ * @return time in nanoseconds
+ */
+uint64_t statsNowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Print every counter as a "name value" line
+ * @param out stream to print to
+ * @return amount of bytes printed
+ */
+int statsPrint(FILE *out) {
+    int bytes = 0;
+    for (size_t i = 0; i < statCount; ++i) {
+        const uint64_t value = __atomic_load_n(statDescriptions[i].counter, __ATOMIC_RELAXED);
+        if (statDescriptions[i].scale == 1) {
+            bytes += fprintf(out, "%s %llu\n", statDescriptions[i].name, (unsigned long long) value);
+        } else {
+            bytes += fprintf(out, "%s %.6f\n", statDescriptions[i].name, (double) value * statDescriptions[i].scale);
+        }
+    }
+    return bytes;
+}
@@ -0,0 +1,44 @@
+#ifndef ASSIGNMENT1_STATS_H
+#define ASSIGNMENT1_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct shellStats {
+    uint64_t commands;
+    uint64_t builtins;
+    uint64_t externals;
+    uint64_t forks;
+    uint64_t poolSpawns;
+    uint64_t zygoteSpawns;
+    uint64_t execFailures;
+    uint64_t pipes;
+    uint64_t jobsQueued;
+    uint64_t jobsLaunched;
+    uint64_t jobsReaped;
+    uint64_t builtinBytes;
+    uint64_t waitNs;
+} shellStats;
+
+extern shellStats stats;
+
+typedef struct statDescription {
+    const char *name;
+    const char *help;
+    const uint64_t *counter;
+    // Multiplier turning the counter into its unit, e.g. nanoseconds into seconds
+    double scale;
+} statDescription;
+
+extern const statDescription statDescriptions[];
+extern const size_t statCount;
+
+// Relaxed atomics, so counters can be bumped from any thread without a lock
+#define STAT_ADD(counter, amount) __atomic_fetch_add(&stats.counter, (uint64_t) (amount), __ATOMIC_RELAXED)
+#define STAT_GET(counter) __atomic_load_n(&stats.counter, __ATOMIC_RELAXED)
+
+uint64_t statsNowNs(void);
+
+int statsPrint(FILE *out);
+
+#endif
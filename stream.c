@@ -0,0 +1,455 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/fcntl.h>
+#include "stream.h"
+#include "count.h"
+#include "decompress.h"
+#include "fields.h"
+#include "parallel.h"
+#include "sort.h"
+
+/**
+ * Stream builtins, commands such as cat that read an input and write an output.
+ * When every stage of a foreground pipeline is a stream builtin that can run in-process (all but parallel) the
+ * shell runs it on its own threads, one per stage, connected by a lock-free ring instead of a kernel pipe. Next to
+ * external commands they run in a forked child like any other command, connected by real pipes.
+ * A builtin named like a system tool only takes over the usage it implements, a command with any other option
+ * runs the system tool as before.
+ */
+
+typedef struct streamCommand {
+    const char *name;
+    streamBuiltin run;
+    // False for builtins that start processes of their own and need real fds, they always run in a child
+    bool inProcess;
+    // Options the builtin implements, e.g. "-r -S:" where a trailing colon takes a value. NULL for the shell's own
+    // commands, which have no system tool to fall back to and handle every usage themselves.
+    const char *options;
+    // Argument the usage must start with, the options then end at the command it runs (parallel --pipe)
+    const char *mode;
+    // Further check of a usage with implemented options, e.g. of the locale or option values, NULL if none
+    bool (*implements)(char *params[]);
+} streamCommand;
+
+typedef struct stage {
+    streamBuiltin run;
+    char **params;
+    stream *in;
+    stream *out;
+    int status;
+} stage;
+
+/**
+ * Call a function on every input file of a command, files that cannot be opened are reported and skipped
+ * @param command name of the command, for errors
+ * @param files files named on the command line, - or none for the input
+ * @param in input of the command
+ * @param out output of the command, the loop stops once it has failed
+ * @param each function to call with every input, returns false on failure
+ * @param context passed to each
+ * @return exit status, 1 if any input failed
+ */
+int streamEachInput(const char *command, char *files[], stream *in, stream *out,
+                    bool (*each)(stream *source, const char *name, void *context), void *context) {
+    static char *standardInput[] = {"-", NULL};
+    int status = 0;
+    for (char **file = *files != NULL ? files : standardInput; *file != NULL && !out->failed; ++file) {
+        stream source;
+        if (strcmp(*file, "-") == 0) {
+            source = *in;
+        } else if (!streamOpen(&source, *file)) {
+            fprintf(stderr, "%s: %s: %s\n", command, *file, strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (!each(&source, *file, context)) {
+            status = 1;
+        }
+        if (source.fd != in->fd) {
+            close(source.fd);
+        }
+    }
+    return status;
+}
+
+/**
+ * Copy one input of cat to its output
+ * @param source input to copy
+ * @param name name of the input, for errors
+ * @param context output stream
+ * @return false if the input could not be read
+ */
+static bool catInput(stream *source, const char *name, void *context) {
+    stream *const out = context;
+    char *const buffer = malloc(STREAM_BUFFER_SIZE);
+    ssize_t n;
+    while ((n = streamRead(source, buffer, STREAM_BUFFER_SIZE)) > 0 && streamWrite(out, buffer, (size_t) n));
+    free(buffer);
+    if (n < 0) {
+        fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Executes the cat command
+ * @param params files to copy to the output, - or none for the input
+ * @param in input of the command
+ * @param out output of the command
+ * @return exit status
+ */
+static int cat(char *params[], stream *in, stream *out) {
+    return streamEachInput("cat", params, in, out, catInput, out);
+}
+
+static const streamCommand streamCommands[] = {
+        {"cat",      cat,      true,  "",                      NULL,     NULL},
+        {"count",    count,    true,  NULL,                    NULL,     NULL},
+        {"fields",   fields,   true,  NULL,                    NULL,     NULL},
+        {"parallel", parallel, false, "-j: --block: --rr -a:", "--pipe", NULL},
+        {"sort",     sort,     true,  "-r -S:",                NULL,     sortImplements},
+#ifdef HAVE_ZLIB
+        {"zcat",     zcat,     true,  "-c",                    NULL,     NULL},
+#endif
+#ifdef HAVE_ZSTD
+        {"zstdcat",  zstdcat,  true,  "-c",                    NULL,     NULL},
+#endif
+};
+
+/**
+ * Match an argument against the options a builtin implements
+ * @param options the builtin's options, e.g. "-r -S:"
+ * @param arg an argument starting with -
+ * @return 0 if it is not one of the options, 1 if it is a complete option, 2 if its value is the next argument
+ */
+static int matchOption(const char *options, const char *arg) {
+    const size_t length = strlen(arg);
+    for (const char *option = options; *option != '\0';) {
+        const size_t optionLength = strcspn(option, " ");
+        const bool takesValue = option[optionLength - 1] == ':';
+        const size_t nameLength = optionLength - takesValue;
+        if (length == nameLength && strncmp(option, arg, nameLength) == 0) {
+            return takesValue ? 2 : 1;
+        }
+        // A single letter option can have its value attached, e.g. -S1G
+        if (takesValue && nameLength == 2 && length > 2 && strncmp(option, arg, 2) == 0) {
+            return 1;
+        }
+        option += optionLength;
+        option += *option == ' ';
+    }
+    return 0;
+}
+
+/**
+ * @param command a stream builtin
+ * @param params arguments of a command named like the builtin
+ * @return true if the builtin implements this usage, false if the system tool has to run it
+ */
+static bool implementsUsage(const streamCommand *command, char *params[]) {
+    if (command->options == NULL) {
+        return true;
+    }
+    if (command->mode != NULL && (*params == NULL || strcmp(*params++, command->mode) != 0)) {
+        return false;
+    }
+    bool operands = false;
+    for (char **param = params; *param != NULL; ++param) {
+        if (**param != '-' || (*param)[1] == '\0') {
+            // The rest runs as the builtin's command
+            if (command->mode != NULL) {
+                break;
+            }
+            operands = true;
+            continue;
+        }
+        // The builtins stop at the first operand, the system tools also take options after it
+        const int match = operands ? 0 : matchOption(command->options, *param);
+        if (match == 0 || (match == 2 && *++param == NULL)) {
+            return false;
+        }
+    }
+    return command->implements == NULL || command->implements(params);
+}
+
+/**
+ * Find the stream builtin that runs a command
+ * @param args command (tokenized)
+ * @return the builtin's entry, NULL if there is none with that name or it does not implement the usage
+ */
+static const streamCommand *findStreamCommand(char *args[]) {
+    for (size_t i = 0; i < sizeof(streamCommands) / sizeof(*streamCommands); ++i) {
+        if (strcmp(*args, streamCommands[i].name) == 0) {
+            return implementsUsage(&streamCommands[i], args + 1) ? &streamCommands[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Find the stream builtin that runs a command
+ * @param args command (tokenized)
+ * @return the builtin, NULL if the command is not run by a builtin
+ */
+static streamBuiltin findStreamBuiltin(char *args[]) {
+    const streamCommand *const command = findStreamCommand(args);
+    return command != NULL ? command->run : NULL;
+}
+
+/**
+ * @param args command (tokenized)
+ * @return true if the command is run by a stream builtin that can run on a thread of the shell
+ */
+static bool runsInProcess(char *args[]) {
+    const streamCommand *const command = findStreamCommand(args);
+    return command != NULL && command->inProcess;
+}
+
+/**
+ * @param args command (tokenized)
+ * @return true if the command is run by a stream builtin rather than a program
+ */
+bool isStreamBuiltin(char *args[]) {
+    return findStreamBuiltin(args) != NULL;
+}
+
+/**
+ * Initialise a stream on a fd
+ * @param s stream to initialise
+ * @param fd fd to read from or write to
+ */
+void streamFromFd(stream *s, int fd) {
+    *s = (stream) {.fd = fd, .ring = NULL, .buffer = NULL, .length = 0, .failed = false};
+}
+
+/**
+ * Initialise a stream on a ring
+ * @param s stream to initialise
+ * @param ring ring to read from or write to
+ */
+static void streamFromRing(stream *s, spscRing *ring) {
+    *s = (stream) {.fd = -1, .ring = ring, .buffer = NULL, .length = 0, .failed = false};
+}
+
+/**
+ * Open a file as an input stream
+ * @param s stream to initialise
+ * @param path file to open
+ * @return true if the file was opened, errno is set otherwise
+ */
+bool streamOpen(stream *s, const char *path) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    streamFromFd(s, fd);
+    return fd >= 0;
+}
+
+/**
+ * Create an unlinked temporary file in $TMPDIR, or /tmp
+ * @param name name of the command, part of the file's name
+ * @return fd of the file, -1 with errno set on failure
+ */
+int streamTemporary(const char *name) {
+    const char *const directory = getenv("TMPDIR");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/assignment1-%sXXXXXX", directory != NULL && *directory != '\0' ? directory : "/tmp",
+             name);
+    const int fd = mkostemp(path, O_CLOEXEC);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    return fd;
+}
+
+/**
+ * Read from a stream
+ * @param s stream to read from
+ * @param buffer buffer to be populated
+ * @param size size of the buffer
+ * @return amount of bytes read, 0 at the end of the stream, -1 with errno set on failure
+ */
+ssize_t streamRead(stream *s, void *buffer, size_t size) {
+    if (s->ring != NULL) {
+        return ringRead(s->ring, buffer, size);
+    }
+    ssize_t n;
+    while ((n = read(s->fd, buffer, size)) < 0 && errno == EINTR);
+    return n;
+}
+
+/**
+ * Write out a stream's buffer
+ * @param s stream to flush
+ * @return false if the stream has failed
+ */
+bool streamFlush(stream *s) {
+    if (s->ring != NULL) {
+        s->failed = s->failed || !ringWrite(s->ring, s->buffer, s->length);
+        s->length = 0;
+        return !s->failed;
+    }
+    size_t done = 0;
+    while (!s->failed && done < s->length) {
+        const ssize_t n = write(s->fd, s->buffer + done, s->length - done);
+        if (n < 0 && errno != EINTR) {
+            s->failed = true;
+        }
+        done += n > 0 ? (size_t) n : 0;
+    }
+    s->length = 0;
+    return !s->failed;
+}
+
+/**
+ * Write to a stream, buffered so that line by line writers do not pay for a syscall or ring update per line
+ * @param s stream to write to
+ * @param buffer bytes to write
+ * @param size amount of bytes
+ * @return false if the stream has failed, e.g. its reader has gone away
+ */
+bool streamWrite(stream *s, const void *buffer, size_t size) {
+    if (s->failed) {
+        return false;
+    }
+    if (s->buffer == NULL) {
+        s->buffer = malloc(STREAM_BUFFER_SIZE);
+    }
+    if (s->length + size > STREAM_BUFFER_SIZE && !streamFlush(s)) {
+        return false;
+    }
+    if (size >= STREAM_BUFFER_SIZE) {
+        s->length = size;
+        // Large writes go straight out rather than through the buffer
+        char *const saved = s->buffer;
+        s->buffer = (char *) buffer;
+        streamFlush(s);
+        s->buffer = saved;
+        return !s->failed;
+    }
+    memcpy(s->buffer + s->length, buffer, size);
+    s->length += size;
+    return true;
+}
+
+/**
+ * Finish writing to a stream, flushing it and closing a ring
+ * @param s stream to finish
+ */
+void streamFinish(stream *s) {
+    streamFlush(s);
+    free(s->buffer);
+    s->buffer = NULL;
+    if (s->ring != NULL) {
+        ringClose(s->ring);
+    }
+}
+
+/**
+ * Run a stream builtin in a child process, on stdin and stdout
+ * @param args command (tokenized)
+ * @return exit status
+ */
+int runStreamBuiltin(char *args[]) {
+    stream in;
+    stream out;
+    streamFromFd(&in, STDIN_FILENO);
+    streamFromFd(&out, STDOUT_FILENO);
+    const int status = findStreamBuiltin(args)(args + 1, &in, &out);
+    streamFinish(&out);
+    return status;
+}
+
+/**
+ * Thread running the left stage of an in-process pipeline
+ * @param context the stage
+ * @return NULL
+ */
+static void *runStage(void *context) {
+    stage *const s = context;
+    s->status = s->run(s->params, s->in, s->out);
+    streamFinish(s->out);
+    return NULL;
+}
+
+/**
+ * @param args command/s (tokenized)
+ * @param cmdPipeIndex the next index after where the pipe was found, -1 if there is no pipe
+ * @return true if every stage is a stream builtin, so the pipeline can run in-process
+ */
+bool isStreamPipeline(char *args[], int cmdPipeIndex) {
+    return runsInProcess(args) && (cmdPipeIndex <= 0 || runsInProcess(args + cmdPipeIndex));
+}
+
+/**
+ * Run two stream builtins connected by a ring, the left one on its own thread
+ * @param args command/s (tokenized)
+ * @param cmdPipeIndex the next index after where the pipe was found
+ * @param in input of the left stage
+ * @param out output of the right stage
+ * @return exit status of the right stage, 1 if the pipeline could not be set up
+ */
+static int runStagePair(char *args[], int cmdPipeIndex, stream *in, stream *out) {
+    spscRing *ring;
+    const int error = posix_memalign((void **) &ring, 64, sizeof(spscRing));
+    if (error) {
+        fprintf(stderr, "pipeline: %s\n", strerror(error));
+        return 1;
+    }
+    ringInit(ring);
+    stream ringOut;
+    stream ringIn;
+    streamFromRing(&ringOut, ring);
+    streamFromRing(&ringIn, ring);
+    stage left = {findStreamBuiltin(args), args + 1, in, &ringOut, 0};
+    pthread_t thread;
+    const int createError = pthread_create(&thread, NULL, runStage, &left);
+    if (createError) {
+        fprintf(stderr, "pipeline: %s\n", strerror(createError));
+        free(ring);
+        return 1;
+    }
+    const int status = findStreamBuiltin(args + cmdPipeIndex)(args + cmdPipeIndex + 1, &ringIn, out);
+    // Like closing the read end of a pipe, the left stage stops once nobody reads its output
+    ringAbandon(ring);
+    pthread_join(thread, NULL);
+    free(ring);
+    return status;
+}
+
+/**
+ * Run a pipeline of stream builtins in the shell process, stages connected by a ring
+ * @param args command/s (tokenized)
+ * @param outputRedirection where the output of the last stage should be redirected, NULL for stdout
+ * @param cmdPipeIndex the next index after where the pipe was found, -1 if there is no pipe
+ * @return exit status of the last stage
+ */
+int runStreamPipeline(char *args[], const char *const outputRedirection, int cmdPipeIndex) {
+    int output = STDOUT_FILENO;
+    if (outputRedirection != NULL) {
+        output = open(outputRedirection, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (output < 0) {
+            perror("error opening file");
+            return 1;
+        }
+    }
+    // Output written by the shell so far must come out first
+    fflush(stdout);
+
+    stream in;
+    stream out;
+    streamFromFd(&in, STDIN_FILENO);
+    streamFromFd(&out, output);
+    const int status = cmdPipeIndex <= 0 ? findStreamBuiltin(args)(args + 1, &in, &out)
+                                         : runStagePair(args, cmdPipeIndex, &in, &out);
+    streamFinish(&out);
+    if (output != STDOUT_FILENO) {
+        close(output);
+    }
+    return status;
+}
@@ -0,0 +1,48 @@
+#ifndef ASSIGNMENT1_STREAM_H
+#define ASSIGNMENT1_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "ring.h"
+
+#define STREAM_BUFFER_SIZE 65536
+
+typedef struct stream {
+    // fd read from or written to, -1 when the stream is on a ring
+    int fd;
+    spscRing *ring;
+    // Output buffer
+    char *buffer;
+    size_t length;
+    bool failed;
+} stream;
+
+typedef int (*streamBuiltin)(char *params[], stream *in, stream *out);
+
+bool isStreamBuiltin(char *args[]);
+
+void streamFromFd(stream *s, int fd);
+
+bool streamOpen(stream *s, const char *path);
+
+int streamTemporary(const char *name);
+
+ssize_t streamRead(stream *s, void *buffer, size_t size);
+
+bool streamWrite(stream *s, const void *buffer, size_t size);
+
+bool streamFlush(stream *s);
+
+void streamFinish(stream *s);
+
+int streamEachInput(const char *command, char *files[], stream *in, stream *out,
+                    bool (*each)(stream *source, const char *name, void *context), void *context);
+
+int runStreamBuiltin(char *args[]);
+
+bool isStreamPipeline(char *args[], int cmdPipeIndex);
+
+int runStreamPipeline(char *args[], const char *outputRedirection, int cmdPipeIndex);
+
+#endif
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include "tokenizer.h"
+
+/**
+ * Tokenize a string so that it can easily be read for commands
+ * @param buffer string to be tokenized
+ * @param bufferEnd last index of the buffer string
+ * @param args array of string tokens to be populated
+ * @param background pointer to bool to be populated, true if the command should be run in the background
+ * @param outputRedirection pointer to string to be populated, NULL if no output redirection will take place
+ * @param cmdPipeIndex pointer to int to be populated, will equal -1 if no command piping is to take place
+ * @return the amount of tokens populated into args
+ */
+int
+getcmd(char *buffer, ssize_t bufferEnd, char *args[], bool *background, char **outputRedirection, int *cmdPipeIndex) {
+    *cmdPipeIndex = -1;
+    *outputRedirection = NULL;
+    *background = false;
+    int i = 0;
+    char *token;
+
+    bool exit = false;
+    // Check if background is specified
+    while (!exit && bufferEnd >= 0 && (buffer[bufferEnd] == '&' || isspace(buffer[bufferEnd]))) {
+        if (buffer[bufferEnd] == '&') {
+            *background = true;
+            buffer[bufferEnd] = ' ';
+            exit = true;
+        }
+        bufferEnd--;
+    }
+    // Skip tokenizing if string is empty
+    if (bufferEnd < 0) {
+        args[0] = NULL;
+        return 0;
+    }
+
+    while ((token = strsep(&buffer, " \t")) != NULL) {
+        if (strlen(token) > 0) {
+            if (i >= ARGS_SIZE) {
+                return INT32_MAX;
+            }
+            if (strcmp(token, ">") == 0) {
+                char *temp = buffer;
+                if ((token = strsep(&temp, " \t")) != NULL) {
+                    *outputRedirection = token;
+                    strsep(&buffer, " \t"); // To skip this instance
+                } else {
+                    fprintf(stderr, "Error parsing '>'");
+                }
+            } else if (strcmp(token, "|") == 0) {
+                if (i == 0 ||
+                    *cmdPipeIndex > 0) { // If it's the first token or there's already been a pipe, then error out
+                    fprintf(stderr, "Error parsing '|'");
+                } else {
+                    args[i++] = NULL;
+                    *cmdPipeIndex = i;
+                }
+            } else {
+                args[i++] = token;
+            }
+        }
+    }
+    args[i] = NULL;
+
+    return i;
+}
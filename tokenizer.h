@@ -0,0 +1,12 @@
+#ifndef ASSIGNMENT1_TOKENIZER_H
+#define ASSIGNMENT1_TOKENIZER_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define ARGS_SIZE 30
+
+int
+getcmd(char *buffer, ssize_t bufferEnd, char *args[], bool *background, char **outputRedirection, int *cmdPipeIndex);
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/fcntl.h>
+#include "trace.h"
+
+/**
+ * Per-phase timing of every command, written as Chrome trace JSON (chrome://tracing, Perfetto).
+ * Records are buffered here rather than in stdio so a forked child never inherits and re-flushes them.
+ */
+
+#define TRACE_BUFFER_SIZE (64 * 1024)
+#define TRACE_RECORD_MAX 512
+
+static const char *const phaseNames[] = {"read", "tokenize", "builtin", "fork", "exec-to-exit", "wait"};
+
+static int traceFd = -1;
+static char traceBuffer[TRACE_BUFFER_SIZE];
+static size_t traceLength = 0;
+static pid_t shellPid;
+static bool traceEmpty;
+
+/**
+ * Write out all buffered records
+ */
+static void traceFlush(void) {
+    size_t written = 0;
+    while (written < traceLength) {
+        const ssize_t n = write(traceFd, traceBuffer + written, traceLength - written);
+        if (n <= 0) {
+            break;
+        }
+        written += (size_t) n;
+    }
+    traceLength = 0;
+}
+
+/**
+ * Start tracing into a file, replacing any trace already open
+ * @param path file to write the trace to
+ * @return true if the file could be opened
+ */
+bool traceOpen(const char *path) {
+    traceClose();
+    traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (traceFd < 0) {
+        return false;
+    }
+    shellPid = getpid();
+    traceLength = (size_t) sprintf(traceBuffer, "[");
+    traceEmpty = true;
+    return true;
+}
+
+/**
+ * Flush and close the trace, if one is open
+ */
+void traceClose(void) {
+    if (traceFd < 0) {
+        return;
+    }
+    traceLength += (size_t) sprintf(traceBuffer + traceLength, "\n]\n");
+    traceFlush();
+    close(traceFd);
+    traceFd = -1;
+}
+
+/**
+ * @return true if a trace is being recorded
+ */
+bool traceEnabled(void) {
+    return traceFd >= 0;
+}
+
+/**
+ * Current monotonic time, cheap to call when tracing is off
+ * @return time in microseconds, 0 if tracing is off
+ */
+uint64_t traceNow(void) {
+    if (traceFd < 0) {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000u + (uint64_t) ts.tv_nsec / 1000u;
+}
+
+/**
+ * Record a phase that started at the given time and ends now
+ * @param phase phase of command execution
+ * @param start time returned by traceNow when the phase started
+ * @param pid process the phase belongs to, the shell's phases should pass 0
+ * @param command name of the command, may be NULL
+ */
+void traceRecord(tracePhase phase, uint64_t start, pid_t pid, const char *command) {
+    // A start of 0 means the phase began before tracing was turned on
+    if (traceFd < 0 || start == 0) {
+        return;
+    }
+    const uint64_t end = traceNow();
+    if (traceLength + TRACE_RECORD_MAX > TRACE_BUFFER_SIZE) {
+        traceFlush();
+    }
+
+    char *const record = traceBuffer + traceLength;
+    int length = sprintf(record, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d",
+                         traceEmpty ? "" : ",", phaseNames[phase], (unsigned long long) start,
+                         (unsigned long long) (end - start), (int) shellPid, (int) (pid ? pid : shellPid));
+    if (command != NULL) {
+        length += sprintf(record + length, ",\"args\":{\"cmd\":\"");
+        // Leave room for the closing characters, long names are cut short
+        for (const char *c = command; *c != '\0' && length < TRACE_RECORD_MAX - 16; ++c) {
+            if (*c == '"' || *c == '\\') {
+                record[length++] = '\\';
+                record[length++] = *c;
+            } else if ((unsigned char) *c >= 0x20) {
+                record[length++] = *c;
+            }
+        }
+        length += sprintf(record + length, "\"}");
+    }
+    record[length++] = '}';
+    traceLength += (size_t) length;
+    traceEmpty = false;
+}
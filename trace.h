@@ -0,0 +1,27 @@
+#ifndef ASSIGNMENT1_TRACE_H
+#define ASSIGNMENT1_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef enum tracePhase {
+    TRACE_READ,
+    TRACE_TOKENIZE,
+    TRACE_BUILTIN,
+    TRACE_FORK,
+    TRACE_CHILD,
+    TRACE_WAIT,
+} tracePhase;
+
+bool traceOpen(const char *path);
+
+void traceClose(void);
+
+bool traceEnabled(void);
+
+uint64_t traceNow(void);
+
+void traceRecord(tracePhase phase, uint64_t start, pid_t pid, const char *command);
+
+#endif
@@ -0,0 +1,331 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/sched.h>
+#include <sys/fcntl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "workerpool.h"
+#include "request.h"
+#include "stats.h"
+
+/**
+ * Prefork worker pool, idle children of the shell that wait on a Unix socket for a command and exec it themselves.
+ * A worker becomes the command, so it is waited for like any other child, and the pool is refilled while the
+ * shell is idle at the prompt. Workers only keep stdin, stdout and stderr open, so commands that need other
+ * inherited fds (the ones naming a coprocess) must be forked by the shell.
+ * Workers are cloned by a spawner, a small helper forked along with the first workers, with CLONE_PARENT so they are
+ * still children of the shell. Replacing a used worker then costs the same however large the shell has grown.
+ */
+
+#define WORKER_POOL_MAX 64
+
+typedef struct worker {
+    pid_t pid;
+    int fd;
+} worker;
+
+typedef struct workerRequest {
+    int niceness;
+    int argc;
+    int envc;
+    int redirected;
+} workerRequest;
+
+extern char **environ;
+
+static worker workers[WORKER_POOL_MAX];
+static int workerCount = 0;
+static int poolSize = 0;
+
+// The spawner's socket and pid, -1 when it is not running
+static int spawnerFd = -1;
+static pid_t spawnerPid = -1;
+
+/**
+ * Main loop of a worker, waits for one request and execs it
+ * @param fd the worker's end of its socket
+ */
+static void runWorker(int fd) {
+    // Ctrl+C goes to the whole process group, an idle worker must survive it
+    signal(SIGINT, SIG_IGN);
+    signal(SIGCHLD, SIG_DFL);
+    close_range(3, (unsigned int) fd - 1, 0);
+    close_range((unsigned int) fd + 1, ~0U, 0);
+
+    static char buffer[REQUEST_SIZE];
+    ssize_t n;
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) < 0 && errno == EINTR);
+    if (n < (ssize_t) sizeof(workerRequest)) {
+        // The shell closed the pool
+        _exit(0);
+    }
+    close(fd);
+
+    workerRequest request;
+    memcpy(&request, buffer, sizeof(request));
+    char *cursor = buffer + sizeof(request);
+    const char *const end = buffer + n;
+    char **const args = malloc(sizeof(char *) * (size_t) (request.argc + 1));
+    char **const env = malloc(sizeof(char *) * (size_t) (request.envc + 1));
+    const char *const cwd = requestTakeString(&cursor, end);
+    for (int i = 0; i < request.argc; ++i) {
+        args[i] = requestTakeString(&cursor, end);
+    }
+    args[request.argc] = NULL;
+    const char *const outputRedirection = request.redirected ? requestTakeString(&cursor, end) : NULL;
+    for (int i = 0; i < request.envc; ++i) {
+        env[i] = requestTakeString(&cursor, end);
+    }
+    env[request.envc] = NULL;
+    if (cwd == NULL || chdir(cwd) != 0) {
+        perror("worker");
+        _exit(127);
+    }
+
+    environ = env;
+    signal(SIGINT, SIG_DFL);
+    if (request.niceness != 0) {
+        nice(request.niceness);
+    }
+    if (outputRedirection != NULL) {
+        const int output = open(outputRedirection, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (output < 0) {
+            perror("error opening file");
+            _exit(127);
+        }
+        if (dup2(output, fileno(stdout)) < 0) {
+            perror("error redirecting stdout");
+            _exit(127);
+        }
+    }
+    execvp(*args, args);
+    printf("Failed to execute command\n");
+    fflush(stdout);
+    _exit(127);
+}
+
+/**
+ * Main loop of the spawner, clones a worker for every request until the shell closes its socket
+ * @param fd the spawner's end of its socket
+ */
+static void runSpawner(int fd) {
+    signal(SIGINT, SIG_IGN);
+    signal(SIGCHLD, SIG_DFL);
+    // Workers keep the stdin, stdout and stderr the spawner was forked with
+    close_range(3, (unsigned int) fd - 1, 0);
+    close_range((unsigned int) fd + 1, ~0U, 0);
+
+    char request;
+    ssize_t n;
+    while ((n = recv(fd, &request, sizeof(request), 0)) > 0 || (n < 0 && errno == EINTR)) {
+        if (n < 0) {
+            continue;
+        }
+        int fds[2] = {-1, -1};
+        pid_t pid = -1;
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == 0) {
+            // With CLONE_PARENT the exit signal has to be left 0, the worker inherits the spawner's (SIGCHLD)
+            struct clone_args cloneArgs = {.flags = CLONE_PARENT};
+            pid = (pid_t) syscall(SYS_clone3, &cloneArgs, sizeof(cloneArgs));
+            if (pid == 0) {
+                close(fd);
+                close(fds[0]);
+                runWorker(fds[1]);
+            }
+            close(fds[1]);
+        }
+        requestSend(fd, &pid, sizeof(pid), fds, pid > 0 ? 1 : 0);
+        if (fds[0] >= 0) {
+            close(fds[0]);
+        }
+    }
+    _exit(0);
+}
+
+/**
+ * Start the spawner, should be done while the shell is small
+ * @return true if the spawner is running
+ */
+static bool startSpawner(void) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds)) {
+        return false;
+    }
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        runSpawner(fds[1]);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return false;
+    }
+    STAT_ADD(forks, 1);
+    spawnerFd = fds[0];
+    spawnerPid = pid;
+    return true;
+}
+
+/**
+ * Stop the spawner, it exits once its socket is closed
+ */
+static void stopSpawner(void) {
+    if (spawnerFd < 0) {
+        return;
+    }
+    close(spawnerFd);
+    waitpid(spawnerPid, NULL, 0);
+    spawnerFd = -1;
+    spawnerPid = -1;
+}
+
+/**
+ * Have the spawner clone one more idle worker
+ * @return true if the worker was started
+ */
+static bool spawnWorker(void) {
+    const char request = 0;
+    pid_t pid = -1;
+    int fds[REQUEST_MAX_FDS];
+    int fdCount = 0;
+    if (send(spawnerFd, &request, sizeof(request), MSG_NOSIGNAL) != sizeof(request) ||
+        requestReceive(spawnerFd, &pid, sizeof(pid), fds, &fdCount) != sizeof(pid)) {
+        // The spawner died, workers are forked by the shell from now on
+        stopSpawner();
+        return false;
+    }
+    if (pid > 0 && fdCount != 1) {
+        // Without its socket the worker exits straight away
+        waitpid(pid, NULL, 0);
+    }
+    if (pid < 0 || fdCount != 1) {
+        return false;
+    }
+    STAT_ADD(forks, 1);
+    workers[workerCount++] = (worker) {pid, fds[0]};
+    return true;
+}
+
+/**
+ * Start one more idle worker, cloned by the spawner or else forked by the shell
+ * @return true if the worker was started
+ */
+static bool addWorker(void) {
+    if (spawnerFd >= 0 && spawnWorker()) {
+        return true;
+    }
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds)) {
+        return false;
+    }
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        runWorker(fds[1]);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return false;
+    }
+    STAT_ADD(forks, 1);
+    workers[workerCount++] = (worker) {pid, fds[0]};
+    return true;
+}
+/**
+ * Stop an idle worker, it exits once its socket is closed
+ * @param w worker to stop
+ */
+static void stopWorker(const worker *const w) {
+    close(w->fd);
+    waitpid(w->pid, NULL, 0);
+}
+
+/**
+ * Set the size of the pool, starting or stopping workers
+ * @param size amount of idle workers to keep, 0 to turn the pool off
+ * @return true if the pool has the requested size
+ */
+bool workerPoolResize(int size) {
+    poolSize = size < WORKER_POOL_MAX ? size : WORKER_POOL_MAX;
+    while (workerCount > poolSize) {
+        stopWorker(&workers[--workerCount]);
+    }
+    if (poolSize == 0) {
+        stopSpawner();
+    } else if (spawnerFd < 0) {
+        startSpawner();
+    }
+    workerPoolFill();
+    return workerCount == size;
+}
+
+/**
+ * @return amount of idle workers the pool keeps, 0 if it is off
+ */
+int workerPoolSize(void) {
+    return poolSize;
+}
+
+/**
+ * Replace the workers used since the last call, off the hot path
+ */
+void workerPoolFill(void) {
+    while (workerCount < poolSize && addWorker());
+}
+
+/**
+ * Run a command in an idle worker
+ * @param args command (tokenized), without a pipe
+ * @param outputRedirection where the output should be redirected, if NULL no redirection will take place
+ * @param niceness nice increment for the command, relative to the shell
+ * @return pid of the command, -1 if no worker could run it and it has to be forked
+ */
+pid_t workerPoolSpawn(char *args[], const char *const outputRedirection, int niceness) {
+    if (workerCount == 0) {
+        return -1;
+    }
+
+    static char buffer[REQUEST_SIZE];
+    workerRequest request = {niceness, 0, 0, outputRedirection != NULL};
+    size_t length = sizeof(request);
+    char *const cwd = getcwd(NULL, 0);
+    bool fits = cwd != NULL && requestAppendString(buffer, &length, cwd);
+    free(cwd);
+    for (; fits && args[request.argc] != NULL; ++request.argc) {
+        fits = requestAppendString(buffer, &length, args[request.argc]);
+    }
+    if (fits && outputRedirection != NULL) {
+        fits = requestAppendString(buffer, &length, outputRedirection);
+    }
+    for (; fits && environ[request.envc] != NULL; ++request.envc) {
+        fits = requestAppendString(buffer, &length, environ[request.envc]);
+    }
+    if (!fits) {
+        return -1;
+    }
+    memcpy(buffer, &request, sizeof(request));
+
+    // Everything printed so far must come out before the command's output
+    fflush(stdout);
+    while (workerCount > 0) {
+        const worker w = workers[--workerCount];
+        const ssize_t sent = send(w.fd, buffer, length, MSG_NOSIGNAL);
+        close(w.fd);
+        if (sent == (ssize_t) length) {
+            return w.pid;
+        }
+        // The worker died while idle
+        waitpid(w.pid, NULL, 0);
+    }
+    return -1;
+}
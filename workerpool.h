@@ -0,0 +1,15 @@
+#ifndef ASSIGNMENT1_WORKERPOOL_H
+#define ASSIGNMENT1_WORKERPOOL_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+bool workerPoolResize(int size);
+
+int workerPoolSize(void);
+
+void workerPoolFill(void);
+
+pid_t workerPoolSpawn(char *args[], const char *outputRedirection, int niceness);
+
+#endif
@@ -0,0 +1,256 @@
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/sched.h>
+#include <sys/fcntl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "zygote.h"
+#include "request.h"
+#include "jobs.h"
+#include "spawn.h"
+#include "stats.h"
+
+/**
+ * Zygote, a small helper forked when the shell starts that spawns commands on its behalf.
+ * Each request carries the argv, environment, cwd and the fds the command inherits (passed with SCM_RIGHTS).
+ * The zygote clones with CLONE_PARENT, so the command is still a child of the shell and is waited for as usual,
+ * and answers with the pid and a pidfd. Forking the zygote costs the same however large the shell has grown.
+ */
+
+typedef struct zygoteRequest {
+    int niceness;
+    int cmdPipeIndex;
+    int argc;
+    int envc;
+    int redirected;
+    int fdCount;
+    // Fd numbers in the command of each passed fd, in order
+    int targets[REQUEST_MAX_FDS];
+} zygoteRequest;
+
+extern char **environ;
+
+static int zygoteFd = -1;
+static pid_t zygotePid = -1;
+
+/**
+ * Run a request in the cloned child
+ * @param request header of the request
+ * @param fds fds passed with the request, close-on-exec
+ * @param cursor strings of the request
+ * @param end end of the request
+ */
+static void runRequest(const zygoteRequest *const request, const int *fds, char *cursor, const char *end) {
+    // Move every fd out of the way first, so placing one cannot overwrite another
+    int highest = 2;
+    for (int i = 0; i < request->fdCount; ++i) {
+        highest = request->targets[i] > highest ? request->targets[i] : highest;
+    }
+    int moved[REQUEST_MAX_FDS];
+    for (int i = 0; i < request->fdCount; ++i) {
+        moved[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, highest + 1);
+    }
+    for (int i = 0; i < request->fdCount; ++i) {
+        dup2(moved[i], request->targets[i]);
+    }
+
+    char **const args = malloc(sizeof(char *) * (size_t) (request->argc + 1));
+    char **const env = malloc(sizeof(char *) * (size_t) (request->envc + 1));
+    const char *const cwd = requestTakeString(&cursor, end);
+    for (int i = 0; i < request->argc; ++i) {
+        args[i] = requestTakeString(&cursor, end);
+    }
+    args[request->argc] = NULL;
+    if (request->cmdPipeIndex > 0) {
+        args[request->cmdPipeIndex - 1] = NULL;
+    }
+    const char *const outputRedirection = request->redirected ? requestTakeString(&cursor, end) : NULL;
+    for (int i = 0; i < request->envc; ++i) {
+        env[i] = requestTakeString(&cursor, end);
+    }
+    env[request->envc] = NULL;
+    if (cwd == NULL || chdir(cwd) != 0) {
+        perror("zygote");
+        _exit(127);
+    }
+
+    environ = env;
+    signal(SIGINT, SIG_DFL);
+    if (request->niceness != 0) {
+        nice(request->niceness);
+    }
+    runPipeline(args, outputRedirection, request->cmdPipeIndex);
+}
+
+/**
+ * Main loop of the zygote, serves requests until the shell closes its socket
+ * @param fd the zygote's end of the socket
+ */
+static void runZygote(int fd) {
+    signal(SIGINT, SIG_IGN);
+    signal(SIGCHLD, SIG_DFL);
+    close_range(0, (unsigned int) fd - 1, 0);
+    close_range((unsigned int) fd + 1, ~0U, 0);
+
+    static char buffer[REQUEST_SIZE];
+    while (1) {
+        int fds[REQUEST_MAX_FDS];
+        int fdCount;
+        const ssize_t n = requestReceive(fd, buffer, sizeof(buffer), fds, &fdCount);
+        if (n < (ssize_t) sizeof(zygoteRequest)) {
+            _exit(0);
+        }
+
+        zygoteRequest request;
+        memcpy(&request, buffer, sizeof(request));
+        int pidfd = -1;
+        pid_t pid = -1;
+        if (fdCount == request.fdCount) {
+            // With CLONE_PARENT the exit signal has to be left 0, the child inherits the zygote's (SIGCHLD)
+            struct clone_args cloneArgs = {.flags = CLONE_PARENT | CLONE_PIDFD, .pidfd = (uint64_t) (uintptr_t) &pidfd};
+            pid = (pid_t) syscall(SYS_clone3, &cloneArgs, sizeof(cloneArgs));
+            if (pid == 0) {
+                close(fd);
+                runRequest(&request, fds, buffer + sizeof(request), buffer + n);
+            }
+        }
+        for (int i = 0; i < fdCount; ++i) {
+            close(fds[i]);
+        }
+
+        requestSend(fd, &pid, sizeof(pid), &pidfd, pid > 0 ? 1 : 0);
+        if (pidfd >= 0) {
+            close(pidfd);
+        }
+    }
+}
+
+/**
+ * Start the zygote, should be done while the shell is small
+ * @return true if the zygote is running
+ */
+bool zygoteOpen(void) {
+    if (zygoteFd >= 0) {
+        return true;
+    }
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds)) {
+        return false;
+    }
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        runZygote(fds[1]);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return false;
+    }
+    STAT_ADD(forks, 1);
+    zygoteFd = fds[0];
+    zygotePid = pid;
+    return true;
+}
+
+/**
+ * Stop the zygote, it exits once its socket is closed
+ */
+void zygoteClose(void) {
+    if (zygoteFd < 0) {
+        return;
+    }
+    close(zygoteFd);
+    waitpid(zygotePid, NULL, 0);
+    zygoteFd = -1;
+    zygotePid = -1;
+}
+
+/**
+ * @return true if the zygote is running
+ */
+bool zygoteActive(void) {
+    return zygoteFd >= 0;
+}
+
+/**
+ * Have the zygote start a command, or two commands connected by a pipe
+ * @param args command/s (tokenized)
+ * @param outputRedirection where the output should be redirected, if NULL no redirection will take place
+ * @param cmdPipeIndex the next index after where the pipe was found, if -1 then no command piping will take place
+ * @param niceness nice increment for the command, relative to the shell
+ * @param pidfd pointer to be populated with a pidfd of the command, may be NULL
+ * @return pid of the command, -1 if the zygote could not start it and it has to be forked
+ */
+pid_t zygoteSpawn(char *args[], const char *const outputRedirection, int cmdPipeIndex, int niceness, int *pidfd) {
+    if (zygoteFd < 0) {
+        return -1;
+    }
+
+    // The command inherits stdin, stdout, stderr and the shell's ends of the coprocess pipes it uses
+    zygoteRequest request = {niceness, cmdPipeIndex, 0, 0, outputRedirection != NULL, 0, {0}};
+    int fds[REQUEST_MAX_FDS];
+    for (int fd = 0; fd < 3; ++fd) {
+        fds[request.fdCount] = fd;
+        request.targets[request.fdCount++] = fd;
+    }
+    for (int side = 0; side < (cmdPipeIndex > 0 ? 2 : 1); ++side) {
+        const int space = REQUEST_MAX_FDS - request.fdCount;
+        const int used = coprocFdsUsed(side == 0 ? args : args + cmdPipeIndex, outputRedirection,
+                                       fds + request.fdCount, space);
+        if (used > space) {
+            return -1;
+        }
+        for (int i = 0; i < used; ++i, ++request.fdCount) {
+            request.targets[request.fdCount] = fds[request.fdCount];
+        }
+    }
+
+    static char buffer[REQUEST_SIZE];
+    size_t length = sizeof(request);
+    char *const cwd = getcwd(NULL, 0);
+    bool fits = cwd != NULL && requestAppendString(buffer, &length, cwd);
+    free(cwd);
+    // The NULL ending the left side of a pipe is sent as an empty string
+    for (; fits && (args[request.argc] != NULL || request.argc + 1 == cmdPipeIndex); ++request.argc) {
+        fits = requestAppendString(buffer, &length, args[request.argc] != NULL ? args[request.argc] : "");
+    }
+    if (fits && outputRedirection != NULL) {
+        fits = requestAppendString(buffer, &length, outputRedirection);
+    }
+    for (; fits && environ[request.envc] != NULL; ++request.envc) {
+        fits = requestAppendString(buffer, &length, environ[request.envc]);
+    }
+    if (!fits) {
+        return -1;
+    }
+    memcpy(buffer, &request, sizeof(request));
+
+    // Everything printed so far must come out before the command's output
+    fflush(stdout);
+    if (requestSend(zygoteFd, buffer, length, fds, request.fdCount) != (ssize_t) length) {
+        // The zygote died, commands are forked from now on
+        zygoteClose();
+        return -1;
+    }
+
+    pid_t pid = -1;
+    int received[REQUEST_MAX_FDS];
+    int receivedCount;
+    if (requestReceive(zygoteFd, &pid, sizeof(pid), received, &receivedCount) != sizeof(pid)) {
+        zygoteClose();
+        return -1;
+    }
+    if (pidfd != NULL) {
+        *pidfd = receivedCount > 0 ? received[0] : -1;
+    } else if (receivedCount > 0) {
+        close(received[0]);
+    }
+    return pid;
+}
@@ -0,0 +1,15 @@
+#ifndef ASSIGNMENT1_ZYGOTE_H
+#define ASSIGNMENT1_ZYGOTE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+bool zygoteOpen(void);
+
+void zygoteClose(void);
+
+bool zygoteActive(void);
+
+pid_t zygoteSpawn(char *args[], const char *outputRedirection, int cmdPipeIndex, int niceness, int *pidfd);
+
+#endif